@@ -2,7 +2,20 @@
 #include <fstream>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdarg>
+#include <climits>
+#include <tuple>
 #include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "tiny.h"
 using namespace std;
 
 
@@ -73,27 +86,57 @@ void AllocateAndCopy(char** a, const char* b)
 ////////////////////////////////////////////////////////////////////////////////////
 // Input and Output ////////////////////////////////////////////////////////////////
 
-#define MAX_LINE_LENGTH 10000
+#define MAX_LINE_LENGTH 10000 // initial size of the line buffer, longer lines grow it
 
 struct InFile
 {
     FILE* file;
+    char* path;
     int cur_line_num;
 
-    char line_buf[MAX_LINE_LENGTH];
+    // source already in memory (batch loader), used instead of file
+    const char* mem_buf;
+    long long mem_size, mem_pos;
+
+    char* line_buf;
+    int max_line_size;
     int cur_ind, cur_line_size;
+    long long cur_line_pos; // byte offset of line_buf[0] in the file
 
     InFile(const char* str)
     {
         file=0;
         if(str) file=fopen(str, "r");
+        AllocateAndCopy(&path, str);
+        line_buf=new char[MAX_LINE_LENGTH];
+        max_line_size=MAX_LINE_LENGTH;
+        mem_buf=0;
+        mem_size=mem_pos=0;
+        cur_line_size=0;
+        cur_ind=0;
+        cur_line_num=0;
+        cur_line_pos=0;
+    }
+    // Reads from size bytes at buf, which must outlive the InFile; str only names the source
+    InFile(const char* str, const char* buf, long long size)
+    {
+        file=0;
+        AllocateAndCopy(&path, str);
+        line_buf=new char[MAX_LINE_LENGTH];
+        max_line_size=MAX_LINE_LENGTH;
+        mem_buf=buf;
+        mem_size=size;
+        mem_pos=0;
         cur_line_size=0;
         cur_ind=0;
         cur_line_num=0;
+        cur_line_pos=0;
     }
     ~InFile()
     {
         if(file) fclose(file);
+        delete[] path;
+        delete[] line_buf;
     }
 
     void SkipSpaces()
@@ -127,12 +170,47 @@ struct InFile
         return false;
     }
 
+    void GrowLineBuf(long long size)
+    {
+        char* new_buf=new char[size];
+        memcpy(new_buf, line_buf, cur_line_size+1);
+        delete[] line_buf;
+        line_buf=new_buf;
+        max_line_size=size;
+    }
+
     bool GetNewLine()
     {
+        cur_line_pos+=cur_line_size;
         cur_ind=0;
+        cur_line_size=0;
         line_buf[0]=0;
-        if(!fgets(line_buf, MAX_LINE_LENGTH, file)) return false;
-        cur_line_size=strlen(line_buf);
+        if(mem_buf)
+        {
+            // same line as fgets would return
+            if(mem_pos>=mem_size) return false;
+            long long n=mem_size-mem_pos;
+            const char* nl=(const char*)memchr(mem_buf+mem_pos, '\n', n);
+            if(nl) n=nl-(mem_buf+mem_pos)+1;
+            if(n>=max_line_size) GrowLineBuf(n+1);
+            memcpy(line_buf, mem_buf+mem_pos, n);
+            line_buf[n]=0;
+            mem_pos+=n;
+            cur_line_size=strlen(line_buf);
+        }
+        else
+        {
+            if(!file || !fgets(line_buf, max_line_size, file)) return false;
+            cur_line_size=strlen(line_buf);
+
+            // the line did not fit, grow the buffer and read the rest of it
+            while(cur_line_size==max_line_size-1 && line_buf[cur_line_size-1]!='\n')
+            {
+                GrowLineBuf(2*max_line_size);
+                if(!fgets(line_buf+cur_line_size, max_line_size-cur_line_size, file)) break;
+                cur_line_size+=strlen(line_buf+cur_line_size);
+            }
+        }
         if(cur_line_size==0) return false; // End of file
         cur_line_num++;
         return true;
@@ -153,6 +231,12 @@ struct InFile
     {
         cur_ind+=num;
     }
+
+    // byte offset of the current position in the file
+    long long CurPos()
+    {
+        return cur_line_pos+cur_ind;
+    }
 };
 
 struct OutFile
@@ -175,21 +259,562 @@ struct OutFile
     }
 };
 
+// Maps byte offsets to line and column numbers for diagnostics
+// The scanner only records offsets; the start of every line is found the first time
+// a position is asked for, by one memchr scan of the source, then looked up by binary search
+struct LineIndex
+{
+    long long* line_starts;
+    long long num_lines, max_lines;
+    bool built;
+
+    LineIndex()
+    {
+        line_starts=0;
+        num_lines=0;
+        max_lines=0;
+        built=false;
+    }
+    ~LineIndex()
+    {
+        delete[] line_starts;
+    }
+
+    void AddLine(long long pos)
+    {
+        if(num_lines==max_lines)
+        {
+            max_lines=max_lines ? 2*max_lines : 1024;
+            long long* new_starts=new long long[max_lines];
+            if(num_lines>0) memcpy(new_starts, line_starts, num_lines*sizeof(long long));
+            delete[] line_starts;
+            line_starts=new_starts;
+        }
+        line_starts[num_lines++]=pos;
+    }
+
+    // Adds the lines starting in the n bytes at buf, which are at buf_pos in the source
+    void AddLines(const char* buf, long long n, long long buf_pos)
+    {
+        const char* p=buf;
+        const char* end=buf+n;
+        while((p=(const char*)memchr(p, '\n', end-p)))
+        {
+            p++;
+            AddLine(buf_pos+(p-buf));
+        }
+    }
+
+    // A source in memory is scanned where it is, a file is read again by its path
+    void Build(const InFile* in_file)
+    {
+        built=true;
+        AddLine(0);
+
+        if(in_file->mem_buf)
+        {
+            AddLines(in_file->mem_buf, in_file->mem_size, 0);
+            return;
+        }
+
+        FILE* file=0;
+        if(in_file->path) file=fopen(in_file->path, "rb");
+        if(!file) return;
+
+        const int BUF_SIZE=1<<16;
+        char* buf=new char[BUF_SIZE];
+        long long buf_pos=0;
+        size_t n;
+        while((n=fread(buf, 1, BUF_SIZE, file))>0)
+        {
+            AddLines(buf, n, buf_pos);
+            buf_pos+=n;
+        }
+        delete[] buf;
+        fclose(file);
+    }
+
+    // line and column are 1 based
+    void Find(const InFile* in_file, long long pos, long long* line, long long* col)
+    {
+        if(!built) Build(in_file);
+
+        // last line starting at or before pos
+        long long lo=0, hi=num_lines-1;
+        while(lo<hi)
+        {
+            long long mid=lo+(hi-lo+1)/2;
+            if(line_starts[mid]<=pos) lo=mid;
+            else hi=mid-1;
+        }
+        *line=lo+1;
+        *col=pos-line_starts[lo]+1;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+// Batch File Loader ///////////////////////////////////////////////////////////////
+
+// Reads many source files into memory with several reads in flight and hands them to
+// handler one by one, in the order of paths, each as soon as it has been read entirely.
+// The buffer belongs to the loader and is freed when handler returns; it is 0 if the
+// file could not be read.
+// On Linux the open/read/close requests go through one io_uring, at most
+// MAX_LOADS_IN_FLIGHT files at a time; without io_uring every file is read with pread.
+
+#define MAX_LOADS_IN_FLIGHT 32
+#define LOAD_BUF_SIZE (1<<16) // first read size, doubled while a file does not fit
+
+typedef void (*LoadHandler)(const char* path, char* buf, long long size, void* data);
+
+// Grows buf to hold at least cap bytes, keeping the first size bytes
+void GrowBuffer(char** buf, long long size, long long cap)
+{
+    char* new_buf=new char[cap];
+    if(size>0) memcpy(new_buf, *buf, size);
+    delete[] *buf;
+    *buf=new_buf;
+}
+
+// Reads a whole file with blocking calls, returns false if it cannot be read
+bool LoadFileSync(const char* path, char** buf, long long* size)
+{
+    *buf=0;
+    *size=0;
+    long long cap=0;
+
+#ifdef __linux__
+    int fd=open(path, O_RDONLY|O_CLOEXEC);
+    if(fd<0) return false;
+
+    struct stat st;
+    cap=(fstat(fd, &st)==0 && st.st_size>0) ? st.st_size+1 : LOAD_BUF_SIZE;
+    *buf=new char[cap];
+    while(true)
+    {
+        if(*size==cap) GrowBuffer(buf, *size, cap*=2);
+        ssize_t n=pread(fd, *buf+*size, cap-*size, *size);
+        if(n<0)
+        {
+            close(fd);
+            delete[] *buf;
+            *buf=0;
+            return false;
+        }
+        if(n==0) break;
+        *size+=n;
+    }
+    close(fd);
+#else
+    FILE* file=fopen(path, "rb");
+    if(!file) return false;
+
+    cap=LOAD_BUF_SIZE;
+    *buf=new char[cap];
+    size_t n;
+    while((n=fread(*buf+*size, 1, cap-*size, file))>0)
+    {
+        *size+=n;
+        if(*size==cap) GrowBuffer(buf, *size, cap*=2);
+    }
+    fclose(file);
+#endif
+    return true;
+}
+
+#ifdef __linux__
+
+// Minimal io_uring over the raw system calls, one submitter and one consumer
+struct IoRing
+{
+    int fd;
+    unsigned num_entries;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    unsigned sq_local_tail; // queued entries not yet published to the kernel
+    unsigned num_pending;
+
+    IoRing()
+    {
+        fd=-1;
+        sq_ring=cq_ring=0;
+        sqes=0;
+        num_pending=0;
+    }
+    ~IoRing()
+    {
+        if(sqes) munmap(sqes, sqes_size);
+        if(cq_ring && cq_ring!=sq_ring) munmap(cq_ring, cq_ring_size);
+        if(sq_ring) munmap(sq_ring, sq_ring_size);
+        if(fd>=0) close(fd);
+    }
+
+    bool Init(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd=syscall(__NR_io_uring_setup, entries, &p);
+        if(fd<0) return false;
+
+        num_entries=p.sq_entries;
+        sq_ring_size=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+        cq_ring_size=p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+        if(p.features&IORING_FEAT_SINGLE_MMAP)
+        {
+            if(cq_ring_size>sq_ring_size) sq_ring_size=cq_ring_size;
+            cq_ring_size=sq_ring_size;
+        }
+
+        void* ptr=mmap(0, sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(ptr==MAP_FAILED) return false;
+        sq_ring=ptr;
+
+        if(p.features&IORING_FEAT_SINGLE_MMAP) cq_ring=sq_ring;
+        else
+        {
+            ptr=mmap(0, cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if(ptr==MAP_FAILED) return false;
+            cq_ring=ptr;
+        }
+
+        sqes_size=p.sq_entries*sizeof(io_uring_sqe);
+        ptr=mmap(0, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(ptr==MAP_FAILED) return false;
+        sqes=(io_uring_sqe*)ptr;
+
+        char* sq=(char*)sq_ring;
+        sq_head=(unsigned*)(sq+p.sq_off.head);
+        sq_tail=(unsigned*)(sq+p.sq_off.tail);
+        sq_mask=(unsigned*)(sq+p.sq_off.ring_mask);
+        sq_array=(unsigned*)(sq+p.sq_off.array);
+
+        char* cq=(char*)cq_ring;
+        cq_head=(unsigned*)(cq+p.cq_off.head);
+        cq_tail=(unsigned*)(cq+p.cq_off.tail);
+        cq_mask=(unsigned*)(cq+p.cq_off.ring_mask);
+        cqes=(io_uring_cqe*)(cq+p.cq_off.cqes);
+
+        sq_local_tail=*sq_tail;
+        return true;
+    }
+
+    // Returns a cleared entry, the caller never queues more than num_entries at once
+    io_uring_sqe* GetSqe(unsigned long long user_data)
+    {
+        unsigned ind=sq_local_tail&*sq_mask;
+        sq_array[ind]=ind;
+        sq_local_tail++;
+        num_pending++;
+
+        io_uring_sqe* sqe=&sqes[ind];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data=user_data;
+        return sqe;
+    }
+
+    // Publishes the queued entries and waits for at least one completion
+    bool SubmitAndWait()
+    {
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        while(true)
+        {
+            int ret=syscall(__NR_io_uring_enter, fd, num_pending, 1, IORING_ENTER_GETEVENTS, 0, 0);
+            if(ret>=0)
+            {
+                num_pending-=ret;
+                return true;
+            }
+            if(errno!=EINTR) return false;
+        }
+    }
+
+    bool GetCqe(unsigned long long* user_data, int* res)
+    {
+        unsigned head=*cq_head;
+        if(head==__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+
+        io_uring_cqe* cqe=&cqes[head&*cq_mask];
+        *user_data=cqe->user_data;
+        *res=cqe->res;
+        __atomic_store_n(cq_head, head+1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+enum LoadState {LOAD_FREE, LOAD_OPEN, LOAD_READ, LOAD_CLOSE, LOAD_DONE};
+
+struct LoadSlot
+{
+    LoadState state;
+    bool ready; // contents can be handed over (buf is 0 if the file could not be read)
+    int path_ind;
+    int fd;
+    char* buf;
+    long long size, cap;
+};
+
+void QueueRead(IoRing* ring, LoadSlot* slot, int slot_ind)
+{
+    if(slot->size==slot->cap) GrowBuffer(&slot->buf, slot->size, slot->cap*=2);
+
+    io_uring_sqe* sqe=ring->GetSqe(slot_ind);
+    sqe->opcode=IORING_OP_READ;
+    sqe->fd=slot->fd;
+    sqe->addr=(unsigned long long)(slot->buf+slot->size);
+    sqe->len=(unsigned)(slot->cap-slot->size);
+    sqe->off=slot->size;
+    slot->state=LOAD_READ;
+}
+
+void QueueClose(IoRing* ring, LoadSlot* slot, int slot_ind)
+{
+    io_uring_sqe* sqe=ring->GetSqe(slot_ind);
+    sqe->opcode=IORING_OP_CLOSE;
+    sqe->fd=slot->fd;
+    slot->state=LOAD_CLOSE;
+}
+
+// Reads the file of slot with blocking calls and marks it ready
+void LoadSlotSync(const char* path, LoadSlot* slot)
+{
+    delete[] slot->buf;
+    if(!LoadFileSync(path, &slot->buf, &slot->size)) slot->buf=0;
+    slot->ready=true;
+}
+
+// Files are started and handed over in the order of paths, a file that completes early
+// keeps its slot until its turn. Every slot has at most one request in flight, so the
+// ring never overflows. Returns the number of paths handled, less if the ring failed.
+int LoadFilesRing(IoRing* ring, const char* const* paths, int num_paths, LoadHandler handler, void* data)
+{
+    LoadSlot slots[MAX_LOADS_IN_FLIGHT];
+    int num_slots=ring->num_entries<MAX_LOADS_IN_FLIGHT ? ring->num_entries : MAX_LOADS_IN_FLIGHT;
+    int next_path=0, next_handled=0;
+    int i;
+    for(i=0; i<num_slots; i++) slots[i].state=LOAD_FREE;
+
+    while(next_handled<num_paths)
+    {
+        // start opening files in the free slots
+        for(i=0; i<num_slots && next_path<num_paths; i++)
+        {
+            LoadSlot* slot=&slots[i];
+            if(slot->state!=LOAD_FREE) continue;
+
+            slot->ready=false;
+            slot->path_ind=next_path++;
+            slot->buf=0;
+            slot->size=0;
+            slot->cap=LOAD_BUF_SIZE;
+
+            io_uring_sqe* sqe=ring->GetSqe(i);
+            sqe->opcode=IORING_OP_OPENAT;
+            sqe->fd=AT_FDCWD;
+            sqe->addr=(unsigned long long)paths[slot->path_ind];
+            sqe->open_flags=O_RDONLY|O_CLOEXEC;
+            slot->state=LOAD_OPEN;
+        }
+
+        if(!ring->SubmitAndWait())
+        {
+            // the ring broke down, finish the files it was holding the plain way
+            for(; next_handled<next_path; next_handled++)
+            {
+                for(i=0; slots[i].state==LOAD_FREE || slots[i].path_ind!=next_handled; i++);
+                LoadSlot* slot=&slots[i];
+                if(slot->state==LOAD_READ) close(slot->fd);
+                if(!slot->ready) LoadSlotSync(paths[next_handled], slot);
+                handler(paths[next_handled], slot->buf, slot->size, data);
+                delete[] slot->buf;
+                slot->state=LOAD_FREE;
+            }
+            return next_handled;
+        }
+
+        unsigned long long slot_ind;
+        int res;
+        while(ring->GetCqe(&slot_ind, &res))
+        {
+            LoadSlot* slot=&slots[slot_ind];
+
+            if(slot->state==LOAD_OPEN)
+            {
+                if(res>=0)
+                {
+                    slot->fd=res;
+                    slot->buf=new char[slot->cap];
+                    QueueRead(ring, slot, slot_ind);
+                }
+                else
+                {
+                    // -EINVAL: the kernel does not know the request, read the file the plain way
+                    if(res==-EINVAL) LoadSlotSync(paths[slot->path_ind], slot);
+                    slot->ready=true;
+                    slot->state=LOAD_DONE;
+                }
+            }
+            else if(slot->state==LOAD_READ)
+            {
+                // a short read means the end of a regular file
+                long long wanted=slot->cap-slot->size;
+                if(res>0) slot->size+=res;
+                if(res>0 && res==wanted) QueueRead(ring, slot, slot_ind);
+                else
+                {
+                    if(res<0)
+                    {
+                        delete[] slot->buf;
+                        slot->buf=0;
+                    }
+                    slot->ready=true;
+                    QueueClose(ring, slot, slot_ind);
+                }
+            }
+            else if(slot->state==LOAD_CLOSE) slot->state=LOAD_DONE;
+        }
+
+        // hand over the files that are ready in order, the closes stay in flight meanwhile
+        while(next_handled<num_paths)
+        {
+            for(i=0; i<num_slots; i++)
+                if(slots[i].state!=LOAD_FREE && slots[i].path_ind==next_handled) break;
+            LoadSlot* slot=&slots[i];
+            if(i==num_slots || !slot->ready) break;
+
+            handler(paths[next_handled], slot->buf, slot->size, data);
+            delete[] slot->buf;
+            slot->buf=0;
+            slot->ready=false;
+            slot->path_ind=-1;
+            next_handled++;
+        }
+
+        // slots whose file is handed over and closed can take the next files
+        for(i=0; i<num_slots; i++)
+            if(slots[i].state==LOAD_DONE && slots[i].path_ind<0) slots[i].state=LOAD_FREE;
+    }
+    return num_paths;
+}
+
+#endif
+
+void LoadFiles(const char* const* paths, int num_paths, LoadHandler handler, void* data)
+{
+    int i=0;
+#ifdef __linux__
+    IoRing ring;
+    if(ring.Init(MAX_LOADS_IN_FLIGHT)) i=LoadFilesRing(&ring, paths, num_paths, handler, data);
+#endif
+
+    for(; i<num_paths; i++)
+    {
+        char* buf;
+        long long size;
+        bool ok=LoadFileSync(paths[i], &buf, &size);
+        handler(paths[i], ok ? buf : 0, size, data);
+        delete[] buf;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 // Compiler Parameters /////////////////////////////////////////////////////////////
 
+struct Diagnostic
+{
+    char* msg;
+    long long pos, line, col;
+};
+
+// Error messages kept in memory instead of printed
+struct DiagnosticList
+{
+    Diagnostic* items;
+    int num_items, max_items;
+
+    DiagnosticList()
+    {
+        items=0;
+        num_items=max_items=0;
+    }
+    ~DiagnosticList()
+    {
+        Clear();
+        delete[] items;
+    }
+
+    void Add(const char* msg, long long pos, long long line, long long col)
+    {
+        if(num_items==max_items)
+        {
+            max_items=max_items ? 2*max_items : 16;
+            Diagnostic* new_items=new Diagnostic[max_items];
+            if(num_items>0) memcpy(new_items, items, num_items*sizeof(Diagnostic));
+            delete[] items;
+            items=new_items;
+        }
+        Diagnostic* d=&items[num_items++];
+        AllocateAndCopy(&d->msg, msg);
+        d->pos=pos;
+        d->line=line;
+        d->col=col;
+    }
+
+    void Clear()
+    {
+        int i;
+        for(i=0; i<num_items; i++) delete[] items[i].msg;
+        num_items=0;
+    }
+};
+
+struct TokenList; // defined with the scanner
+
 struct CompilerInfo
 {
     InFile in_file;
     OutFile out_file;
     OutFile debug_file;
+    LineIndex line_index;
+    int num_errors;
+
+    DiagnosticList* diagnostics; // 0 prints the errors to stdout
+    TokenList* tokens; // 0 does not keep the scanned tokens
 
     CompilerInfo(const char* in_str, const char* out_str, const char* debug_str)
         : in_file(in_str), out_file(out_str), debug_file(debug_str)
     {
+        num_errors=0;
+        diagnostics=0;
+        tokens=0;
+    }
+    CompilerInfo(const char* in_str, const char* in_buf, long long in_size, const char* out_str, const char* debug_str)
+        : in_file(in_str, in_buf, in_size), out_file(out_str), debug_file(debug_str)
+    {
+        num_errors=0;
+        diagnostics=0;
+        tokens=0;
     }
 };
 
+// Prints an error message followed by the line and column of the byte offset pos,
+// or adds it to ci->diagnostics
+void ReportError(CompilerInfo* ci, long long pos, const char* msg)
+{
+    long long line, col;
+    ci->line_index.Find(&ci->in_file, pos, &line, &col);
+    if(ci->diagnostics) ci->diagnostics->Add(msg, pos, line, col);
+    else cout << msg << " (line " << line << ", column " << col << ")" << endl;
+    ci->num_errors++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 // Scanner /////////////////////////////////////////////////////////////////////////
 
@@ -224,16 +849,19 @@ struct Token
 {
     TokenType type;
     char str[MAX_TOKEN_LEN+1];
+    long long pos; // byte offset of the token in the source
 
     Token()
     {
         str[0]=0;
         type=ERROR;
+        pos=0;
     }
     Token(TokenType _type, const char* _str)
     {
         type=_type;
         Copy(str, _str);
+        pos=0;
     }
 };
 
@@ -283,54 +911,92 @@ inline bool IsLetterOrUnderscore(char ch)
     return (IsLetter(ch) || ch=='_');
 }
 
-void GetNextToken(CompilerInfo* pci, Token* ptoken)
+// Tokens in the order they were scanned
+struct TokenList
 {
-    ptoken->type=ERROR;
-    ptoken->str[0]=0;
+    Token* items;
+    int num_items, max_items;
 
-    int i;
-    char* s=pci->in_file.GetNextTokenStr();
-    if(!s)
+    TokenList()
     {
-        ptoken->type=ENDFILE;
-        ptoken->str[0]=0;
-        return;
+        items=0;
+        num_items=max_items=0;
+    }
+    ~TokenList()
+    {
+        delete[] items;
     }
 
-    for(i=0; i<num_symbolic_tokens; i++)
+    void Add(const Token* token)
     {
-        if(StartsWith(s, symbolic_tokens[i].str))
-            break;
+        if(num_items==max_items)
+        {
+            max_items=max_items ? 2*max_items : 256;
+            Token* new_items=new Token[max_items];
+            if(num_items>0) memcpy(new_items, items, num_items*sizeof(Token));
+            delete[] items;
+            items=new_items;
+        }
+        items[num_items++]=*token;
     }
+};
 
-    if(i<num_symbolic_tokens)
+// Numbers and identifiers longer than MAX_TOKEN_LEN are returned as ERROR tokens
+// holding their first MAX_TOKEN_LEN characters, and so is any character that starts no token
+void ScanToken(CompilerInfo* pci, Token* ptoken)
+{
+    ptoken->type=ERROR;
+    ptoken->str[0]=0;
+
+    int i;
+    char* s;
+
+    //Skip the comments in a loop, one after the other
+    while(true)
     {
-        if(symbolic_tokens[i].type==LEFT_BRACE)
+        s=pci->in_file.GetNextTokenStr();
+        ptoken->pos=pci->in_file.CurPos();
+        if(!s)
+        {
+            ptoken->type=ENDFILE;
+            ptoken->str[0]=0;
+            return;
+        }
+
+        for(i=0; i<num_symbolic_tokens; i++)
         {
-            pci->in_file.Advance(strlen(symbolic_tokens[i].str));
-            if(!pci->in_file.SkipUpto(symbolic_tokens[i+1].str)) return;
-            return GetNextToken(pci, ptoken);
+            if(StartsWith(s, symbolic_tokens[i].str))
+                break;
         }
+
+        if(i==num_symbolic_tokens || symbolic_tokens[i].type!=LEFT_BRACE) break;
+
+        pci->in_file.Advance(strlen(symbolic_tokens[i].str));
+        if(!pci->in_file.SkipUpto(symbolic_tokens[i+1].str)) return;
+    }
+
+    int len=1;
+    if(i<num_symbolic_tokens)
+    {
         ptoken->type=symbolic_tokens[i].type;
         Copy(ptoken->str, symbolic_tokens[i].str);
+        len=strlen(ptoken->str);
     }
     else if(IsDigit(s[0]))
     {
-        int j=1;
-        while(IsDigit(s[j])) j++;
+        while(IsDigit(s[len])) len++;
 
-        ptoken->type=NUM;
-        Copy(ptoken->str, s, j);
+        ptoken->type=len<=MAX_TOKEN_LEN ? NUM : ERROR;
+        Copy(ptoken->str, s, len<=MAX_TOKEN_LEN ? len : MAX_TOKEN_LEN);
     }
     else if(IsLetterOrUnderscore(s[0]))
     {
-        int j=1;
-        while(IsLetterOrUnderscore(s[j])) j++;
+        while(IsLetterOrUnderscore(s[len])) len++;
 
-        ptoken->type=ID;
-        Copy(ptoken->str, s, j);
+        ptoken->type=len<=MAX_TOKEN_LEN ? ID : ERROR;
+        Copy(ptoken->str, s, len<=MAX_TOKEN_LEN ? len : MAX_TOKEN_LEN);
 
-        for(i=0; i<num_reserved_words; i++)
+        for(i=0; ptoken->type==ID && i<num_reserved_words; i++)
         {
             if(Equals(ptoken->str, reserved_words[i].str))
             {
@@ -339,9 +1005,16 @@ void GetNextToken(CompilerInfo* pci, Token* ptoken)
             }
         }
     }
+    else Copy(ptoken->str, s, 1);
+
+    pci->in_file.Advance(len);
+}
 
-    int len=strlen(ptoken->str);
-    if(len>0) pci->in_file.Advance(len);
+// Scans the next token and keeps it in pci->tokens if asked
+void GetNextToken(CompilerInfo* pci, Token* ptoken)
+{
+    ScanToken(pci, ptoken);
+    if(pci->tokens && ptoken->type!=ENDFILE) pci->tokens->Add(ptoken);
 }
 ////////////////////////////////////////////////////////////////////////////////////
 // Parser //////////////////////////////////////////////////////////////////////////
@@ -359,6 +1032,7 @@ void GetNextToken(CompilerInfo* pci, Token* ptoken)
 // term -> factor { (*|/) factor }    left associative
 // factor -> newexpr { ^ newexpr }    right associative
 // newexpr -> ( mathexpr ) | number | identifier
+// expr, mathexpr, term and factor are parsed together by precedence climbing (exp_binding)
 
 enum NodeKind
 {
@@ -398,20 +1072,34 @@ struct TreeNode
     }; // defined for expression/int/identifier only
     ExprDataType expr_data_type; // defined for expression/int/identifier only
 
-    int line_num;
+    long long pos; // byte offset of the node's token, line/column come from CompilerInfo::line_index
 
     TreeNode()
     {
         int i;
         for(i=0; i<MAX_CHILDREN; i++) child[i]=0;
         sibling=0;
+        id=0;
         expr_data_type=VOID;
+        pos=0;
     }
 };
 
+// Parentheses, if and repeat may nest this deep, deeper input stops the parse
+// instead of overflowing the stack
+#define MAX_NESTING_DEPTH 1000
+
 struct ParseInfo
 {
     Token next_token;
+    int depth; // parentheses, if and repeat open around next_token
+    bool aborted; // the input nested too deep, the token stream was cut
+
+    ParseInfo()
+    {
+        depth=0;
+        aborted=false;
+    }
 };
 
 TreeNode* exp_evaluate(CompilerInfo*ci, ParseInfo*pi);
@@ -422,20 +1110,44 @@ TreeNode* repeat_stmt(CompilerInfo* ci, ParseInfo* pi);
 TreeNode* assign_stmt(CompilerInfo* ci, ParseInfo* pi);
 TreeNode* read_stmt(CompilerInfo* ci, ParseInfo* pi);
 TreeNode* write_stmt(CompilerInfo* ci, ParseInfo* pi);
-TreeNode* math_exp_calc(CompilerInfo* ci, ParseInfo* pi);
-TreeNode* factor(CompilerInfo* ci, ParseInfo* pi);
-TreeNode* term(CompilerInfo* ci, ParseInfo* pi);
+TreeNode* exp_binding(CompilerInfo* ci, ParseInfo* pi, int min_bp);
 TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi);
 
 //Ensuring the current token aligns with the expected type
 //then advance to the next token
 void Matching_Perform(CompilerInfo* ci, ParseInfo* pi, TokenType exT)
 {
+    //Once the parse was stopped the input stays at its end
+    if (pi->aborted) return;
+
     //Move to the next token
     GetNextToken(ci, &pi->next_token);
 
 }
 
+//Called before parsing a nested parenthesis, if or repeat
+//Past MAX_NESTING_DEPTH it reports the error once and ends the token stream,
+//so every open rule returns quickly and the parse stops
+bool Enter_Nesting(CompilerInfo* ci, ParseInfo* pi)
+{
+    if (pi->depth < MAX_NESTING_DEPTH)
+    {
+        pi->depth++;
+        return true;
+    }
+
+    if (!pi->aborted) ReportError(ci, pi->next_token.pos, "ERROR: Nesting too deep, parsing stopped");
+    pi->aborted = true;
+    pi->next_token.type = ENDFILE;
+    return false;
+}
+
+//Called after the nested construct is parsed
+void Leave_Nesting(ParseInfo* pi)
+{
+    pi->depth--;
+}
+
 //stmtseq -> stmt { ; stmt }
 //Parse the first statement and then iterate over subsequent statements,
 TreeNode* stmt_seq(CompilerInfo* ci, ParseInfo* pi)
@@ -456,8 +1168,12 @@ TreeNode* stmt_seq(CompilerInfo* ci, ParseInfo* pi)
         //Parse the next statement in the sequence
         TreeNode* NextT = stmt(ci, pi);
 
+        //Skip the statements that could not be parsed
+        if (!NextT) continue;
+
         //Assign the next_tree to be as a sibling to the last_tree
-        LastT->sibling = NextT;
+        if (LastT) LastT->sibling = NextT;
+        else FirstT = NextT;
 
         //Update the last_tree
         LastT = NextT;
@@ -491,7 +1207,7 @@ TreeNode* stmt(CompilerInfo* ci, ParseInfo* pi)
         newT = repeat_stmt(ci, pi);
     //If none, then output this error message
     else
-        cout << "ERROR: Unexpected token in stmt !" << endl;
+        if (!pi->aborted) ReportError(ci, pi->next_token.pos, "ERROR: Unexpected token in stmt !");
 
     //Return the tree
     return newT;
@@ -501,9 +1217,13 @@ TreeNode* stmt(CompilerInfo* ci, ParseInfo* pi)
 //create a tree node for the if statement
 TreeNode* if_stmt(CompilerInfo* ci, ParseInfo* pi)
 {
+    //Guard the recursion of nested statements
+    if (!Enter_Nesting(ci, pi)) return NULL;
+
     //Create a new node for if statement
     TreeNode* newT = new TreeNode;
     newT->node_kind = IF_NODE;
+    newT->pos = pi->next_token.pos;
 
     //Match IF keyword
     Matching_Perform(ci, pi, IF);
@@ -530,6 +1250,8 @@ TreeNode* if_stmt(CompilerInfo* ci, ParseInfo* pi)
     //Match the END keyword
     Matching_Perform(ci, pi, END);
 
+    Leave_Nesting(pi);
+
     //Return the tree
     return newT;
 }
@@ -537,9 +1259,13 @@ TreeNode* if_stmt(CompilerInfo* ci, ParseInfo* pi)
 //parse and create node tree for the repeat statement
 TreeNode* repeat_stmt(CompilerInfo* ci, ParseInfo* pi)
 {
+    //Guard the recursion of nested statements
+    if (!Enter_Nesting(ci, pi)) return NULL;
+
     // Create a new node for repeat statement
     TreeNode* newT = new TreeNode;
     newT->node_kind = REPEAT_NODE;
+    newT->pos = pi->next_token.pos;
 
     //Match REPEAT keyword
     Matching_Perform(ci, pi, REPEAT);
@@ -553,6 +1279,8 @@ TreeNode* repeat_stmt(CompilerInfo* ci, ParseInfo* pi)
     //Parse the expression as to be the second child of this repeat node
     newT->child[1] = exp_evaluate(ci, pi);
 
+    Leave_Nesting(pi);
+
     //Return the tree
     return newT;
 }
@@ -564,6 +1292,7 @@ TreeNode* assign_stmt(CompilerInfo* ci, ParseInfo* pi)
     //Create a new node for this assignment statement
     TreeNode* newT = new TreeNode;
     newT->node_kind = ASSIGN_NODE;
+    newT->pos = pi->next_token.pos;
 
     //Check if next token is identifier
     if (pi->next_token.type == ID)
@@ -593,6 +1322,7 @@ TreeNode* write_stmt(CompilerInfo* ci, ParseInfo* pi)
     //Create a new node to be for the write statement
     TreeNode* TR = new TreeNode;
     TR->node_kind = WRITE_NODE;
+    TR->pos = pi->next_token.pos;
 
     // Perform Matching write keyword
     Matching_Perform(ci, pi, WRITE);
@@ -611,6 +1341,7 @@ TreeNode* read_stmt(CompilerInfo* ci, ParseInfo* pi)
     // Create a new node to be for this read statement
     TreeNode* T = new TreeNode;
     T->node_kind = READ_NODE;
+    T->pos = pi->next_token.pos;
 
     //Matching with  keyword read
     Matching_Perform(ci, pi, READ);
@@ -629,130 +1360,101 @@ TreeNode* read_stmt(CompilerInfo* ci, ParseInfo* pi)
     return T;
 }
 
+// Binding powers used by the expression parser, indexed by TokenType
+// 0 means the token is not a binary operator and ends the expression
+// < and = bind the loosest and are non associative: mathexpr [ (<|=) mathexpr ]
+// + and - are left associative, then * and / left associative
+// ^ binds the tightest and is right associative
+enum Associativity {NON_ASSOC, LEFT_ASSOC, RIGHT_ASSOC};
+
+struct BindingPower
+{
+    int lbp;
+    Associativity assoc;
+};
+
+const BindingPower binding_powers[]=
+{
+    {0, NON_ASSOC}, {0, NON_ASSOC}, {0, NON_ASSOC}, {0, NON_ASSOC}, // If Then Else End
+    {0, NON_ASSOC}, {0, NON_ASSOC}, {0, NON_ASSOC}, {0, NON_ASSOC}, // Repeat Until Read Write
+    {0, NON_ASSOC}, {10, NON_ASSOC}, {10, NON_ASSOC},               // Assign Equal LessThan
+    {20, LEFT_ASSOC}, {20, LEFT_ASSOC},                             // Plus Minus
+    {30, LEFT_ASSOC}, {30, LEFT_ASSOC},                             // Times Divide
+    {40, RIGHT_ASSOC},                                              // Power
+    {0, NON_ASSOC},                                                 // SemiColon
+    {0, NON_ASSOC}, {0, NON_ASSOC},                                 // LeftParen RightParen
+    {0, NON_ASSOC}, {0, NON_ASSOC},                                 // LeftBrace RightBrace
+    {0, NON_ASSOC}, {0, NON_ASSOC},                                 // ID Num
+    {0, NON_ASSOC}, {0, NON_ASSOC}                                  // EndFile Error
+};
+
 // expr -> mathexpr [ (<|=) mathexpr ]
 // Function to parse and create an expression node
 TreeNode* exp_evaluate(CompilerInfo* ci, ParseInfo* pi)
 {
-    //create a tree node for the mathematical expression
-    TreeNode* t1 = math_exp_calc(ci, pi);
+    //Any operator may start the expression, so the minimum binding power is the lowest one
+    return exp_binding(ci, pi, 1);
+}
+
+// Precedence climbing over binding_powers
+// Parses a primary then keeps folding operators that bind at least as tight as min_bp
+// gives the same trees as the mathexpr/term/factor/newexpr chain with one call per primary
+TreeNode* exp_binding(CompilerInfo* ci, ParseInfo* pi, int min_bp)
+{
+    //Parse the leftmost operand
+    TreeNode* Tree = new_exp(ci, pi);
 
-    // Check if the next token = or < operator
-    if ( pi->next_token.type == LESS_THAN || pi->next_token.type == EQUAL)
+    while (true)
     {
-        //Create a newnode for the operator of the comparison
-        TreeNode* t2 = new TreeNode;
-        t2->node_kind = OPER_NODE;
-        t2->oper = pi->next_token.type;
+        //Stop when the next token is not an operator or binds looser than this level
+        TokenType op = pi->next_token.type;
+        const BindingPower& bp = binding_powers[op];
+        if (bp.lbp == 0 || bp.lbp < min_bp) break;
+
+        //Create a new node for the operator
+        TreeNode* newTree = new TreeNode;
+        newTree->node_kind = OPER_NODE;
+        newTree->pos = pi->next_token.pos;
+        newTree->oper = op;
 
         //assign the left child as to be the previous tree
-        t2->child[0] = t1;
+        newTree->child[0] = Tree;
         //perform matching with the operator
-        Matching_Perform(ci, pi, pi->next_token.type);
+        Matching_Perform(ci, pi, op);
 
-        // Parse and set the right child as the next mathematical expression
-        t2->child[1] = math_exp_calc(ci, pi);
+        //Parse the right side one level tighter, so operators of this level are folded here
+        TreeNode* Right = exp_binding(ci, pi, bp.lbp + 1);
 
-        // Update the tree
-        t1 = t2;
-    }
-    // Return the tree
-    return t1;
-}
-
-// mathexpr -> term { (+|-) term }    left associative
-// Function to parse and create a mathematical expression node
-TreeNode* math_exp_calc(CompilerInfo* ci, ParseInfo* pi)
-{
-
-    //Parse and create a tree node for the leftmost term
-    TreeNode* Tree = term(ci, pi);
-
-    //parsing while the next token is + or - operator
-    while (  pi->next_token.type == MINUS || pi->next_token.type == PLUS )
-    {
-        //Create a new node for the operator
-        TreeNode* newTree = new TreeNode;
-        newTree->node_kind = OPER_NODE;
-        newTree->oper = pi->next_token.type;
+        //A right associative chain a ^ b ^ c becomes a ^ (b ^ c) in this loop
+        //instead of one recursion per operator
+        TreeNode* LastT = newTree;
+        while (bp.assoc == RIGHT_ASSOC && binding_powers[pi->next_token.type].lbp == bp.lbp)
+        {
+            TreeNode* NextT = new TreeNode;
+            NextT->node_kind = OPER_NODE;
+            NextT->pos = pi->next_token.pos;
+            NextT->oper = pi->next_token.type;
 
-        //assign the left child as to be the previous tree
-        newTree->child[0] = Tree;
-        //perform matching with the operator
-        Matching_Perform(ci, pi, pi->next_token.type);
+            NextT->child[0] = Right;
+            LastT->child[1] = NextT;
+            LastT = NextT;
+            Matching_Perform(ci, pi, NextT->oper);
 
-        //Parse and assign the right child as to be the next term
-        newTree->child[1] = term(ci, pi);
+            Right = exp_binding(ci, pi, bp.lbp + 1);
+        }
+        LastT->child[1] = Right;
 
         //Update the tree
         Tree = newTree;
+
+        //Only one comparison is allowed in an expression
+        if (bp.assoc == NON_ASSOC) break;
     }
 
     // Return the tree
     return Tree;
 }
 
-// factor -> newexpr { ^ newexpr }
-//create a factor expression node
-TreeNode* factor(CompilerInfo* ci, ParseInfo* pi)
-{
-    //create a tree node using the new_exp
-    TreeNode* FirsT = new_exp(ci, pi);
-
-    //Check if the next token ^ operator
-    if (pi->next_token.type == POWER)
-    {
-        //Create a new node for the operation of power operation
-        TreeNode* SecT = new TreeNode;
-        SecT->node_kind = OPER_NODE;
-        SecT->oper = pi->next_token.type;
-
-        // Set the base expression as the left child
-        SecT->child[0] = FirsT;
-
-        //Perform matching function with the token of the power
-        Matching_Perform(ci, pi, pi->next_token.type);
-
-        //Parse and set the exponent expression as the right child
-        SecT->child[1] = factor(ci, pi);
-
-        //Update the tree to the new operator tree for left associativity
-        FirsT = SecT;
-    }
-    //return the base node of the tree expression If the power operator is not present
-    return FirsT;
-}
-
-//Constructs a tree node for a term expression by parsing factors
-//term -> factor { (*|/) factor }    left associative
-TreeNode* term(CompilerInfo* ci, ParseInfo* pi)
-{
-
-    // create a tree node for the factor of the leftmost
-    TreeNode* Tree_1 = factor(ci, pi);
-
-    //parsing while the next token is a * or / operator
-    while ( pi->next_token.type == DIVIDE || pi->next_token.type == TIMES )
-    {
-        // Create a new tree node for the operator
-        TreeNode* Tree_2 = new TreeNode;
-        Tree_2->node_kind = OPER_NODE;
-        Tree_2->oper = pi->next_token.type;
-
-        //Set the left child as the previous tree
-        Tree_2->child[0] = Tree_1;
-        //perform matching with the operator
-        Matching_Perform(ci, pi, pi->next_token.type);
-
-        //set the right child as the next factor
-        Tree_2->child[1] = factor(ci, pi);
-
-        //Update the tree
-        Tree_1 = Tree_2;
-    }
-    // Return the final tree
-    return Tree_1;
-}
-
 //newexpr -> ( mathexpr ) | number | identifier
 //Function to reate new expression node based on the next token and handling cases of numeric literals, identifiers, and parenthesized expressions
 TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi)
@@ -765,6 +1467,7 @@ TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi)
         //create node
         t = new TreeNode;
         t->node_kind = NUM_NODE;
+        t->pos = pi->next_token.pos;
 
         //Convert the numeric literal to integer
         char* N_st = pi->next_token.str;
@@ -783,6 +1486,7 @@ TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi)
         //Create an identifier node
         t = new TreeNode;
         t->node_kind = ID_NODE;
+        t->pos = pi->next_token.pos;
 
         //Copy the string
         AllocateAndCopy(&t->id, pi->next_token.str);
@@ -797,6 +1501,9 @@ TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi)
     //Check the next token left parenthesis
     if (pi->next_token.type == LEFT_PAREN)
     {
+        //Guard the recursion of nested parentheses
+        if (!Enter_Nesting(ci, pi)) return t;
+
         //matching the LEFT_PAREN token
         Matching_Perform(ci, pi, LEFT_PAREN);
 
@@ -806,12 +1513,15 @@ TreeNode* new_exp(CompilerInfo* ci, ParseInfo* pi)
         //matching the Right_PAREN token
         Matching_Perform(ci, pi, RIGHT_PAREN);
 
+        Leave_Nesting(pi);
+
         // Return the tree
         return t;
     }
 
     //If none of this expected cases, then display this error message
-    cout << "ERROR: Unexpected token in newexpr !" << endl;
+    if (!pi->aborted) ReportError(ci, pi->next_token.pos, "ERROR: Unexpected token in newexpr !");
+    return t;
 }
 
 // program -> stmtseq
@@ -831,68 +1541,1665 @@ TreeNode* Parser(CompilerInfo* ci)
     if (pi.next_token.type != ENDFILE)
     {
         //Display an error message  for the unexpected token
-        cout << "Error: Unexpected token ," << " Code ends before file ends." << endl;
+        ReportError(ci, pi.next_token.pos, "Error: Unexpected token , Code ends before file ends.");
     }
 
     //Return the parse tree
     return ParseT;
 }
 
-// Function to display the structure of the tree
-void PrintTree(TreeNode* node, int sh=0)
+// Streaming variant of Parser for inputs too large to hold as one tree
+// Parses the top level stmtseq one statement at a time and hands every complete
+// statement (with no sibling) to handler, which owns it from then on.
+// Peak memory is bounded by the largest top level statement instead of the file.
+void StreamParser(CompilerInfo* ci, void (*handler)(TreeNode* stmt, void* data), void* data)
+{
+    //Making object of ParserInfo
+    ParseInfo pi;
+
+    //Retrieve the next token from the input program
+    GetNextToken(ci, &pi.next_token);
+
+    //Same loop as stmt_seq, but statements are handed over instead of linked as siblings
+    TreeNode* T = stmt(ci, &pi);
+    if (T) handler(T, data);
+
+    while (pi.next_token.type != ENDFILE && pi.next_token.type != ELSE && pi.next_token.type != END &&
+            pi.next_token.type != UNTIL)
+    {
+        //Make sure that the statements are separated by semicolons
+        Matching_Perform(ci, &pi, SEMI_COLON);
+
+        //Parse the next statement in the sequence
+        T = stmt(ci, &pi);
+        if (T) handler(T, data);
+    }
+
+    //Check if it is reached the end, then it will display this error message
+    if (pi.next_token.type != ENDFILE)
+    {
+        //Display an error message  for the unexpected token
+        ReportError(ci, pi.next_token.pos, "Error: Unexpected token , Code ends before file ends.");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Tree Traversal //////////////////////////////////////////////////////////////////
+
+// Walks a tree in the order PrintTree prints it: node, children, then the siblings.
+// A pass derives from TreeWalker<Pass> (CRTP) and defines any of the hooks
+//     template<NodeKind kind> void Pre(TreeNode* node, int depth)   before the children
+//     template<NodeKind kind> void Post(TreeNode* node, int depth)  after the children
+// kind is a compile time constant, so tests on it fold away and nothing is virtual.
+// The sibling is read before Post, so Post may free the node.
+// The walk keeps its own stack, so long operator chains cannot overflow the call stack.
+struct WalkFrame
+{
+    TreeNode* node;
+    int depth;
+    int next_child;
+};
+
+// Doubles an explicit stack that starts in a local array
+template<class Frame>
+void GrowFrames(Frame** stack, int num_frames, int* max_frames, Frame* local_stack)
+{
+    Frame* new_stack=new Frame[2*(*max_frames)];
+    memcpy(new_stack, *stack, num_frames*sizeof(Frame));
+    if(*stack!=local_stack) delete[] *stack;
+    *stack=new_stack;
+    *max_frames*=2;
+}
+
+template<class Derived>
+struct TreeWalker
+{
+    template<NodeKind kind> void Pre(TreeNode* node, int depth) {}
+    template<NodeKind kind> void Post(TreeNode* node, int depth) {}
+
+    void VisitPre(TreeNode* node, int depth)
+    {
+        Derived* self=static_cast<Derived*>(this);
+        switch(node->node_kind)
+        {
+            case IF_NODE: self->template Pre<IF_NODE>(node, depth); break;
+            case REPEAT_NODE: self->template Pre<REPEAT_NODE>(node, depth); break;
+            case ASSIGN_NODE: self->template Pre<ASSIGN_NODE>(node, depth); break;
+            case READ_NODE: self->template Pre<READ_NODE>(node, depth); break;
+            case WRITE_NODE: self->template Pre<WRITE_NODE>(node, depth); break;
+            case OPER_NODE: self->template Pre<OPER_NODE>(node, depth); break;
+            case NUM_NODE: self->template Pre<NUM_NODE>(node, depth); break;
+            case ID_NODE: self->template Pre<ID_NODE>(node, depth); break;
+        }
+    }
+
+    void VisitPost(TreeNode* node, int depth)
+    {
+        Derived* self=static_cast<Derived*>(this);
+        switch(node->node_kind)
+        {
+            case IF_NODE: self->template Post<IF_NODE>(node, depth); break;
+            case REPEAT_NODE: self->template Post<REPEAT_NODE>(node, depth); break;
+            case ASSIGN_NODE: self->template Post<ASSIGN_NODE>(node, depth); break;
+            case READ_NODE: self->template Post<READ_NODE>(node, depth); break;
+            case WRITE_NODE: self->template Post<WRITE_NODE>(node, depth); break;
+            case OPER_NODE: self->template Post<OPER_NODE>(node, depth); break;
+            case NUM_NODE: self->template Post<NUM_NODE>(node, depth); break;
+            case ID_NODE: self->template Post<ID_NODE>(node, depth); break;
+        }
+    }
+
+    void Walk(TreeNode* node, int depth=0)
+    {
+        if(!node) return;
+
+        WalkFrame local_stack[64];
+        WalkFrame* stack=local_stack;
+        int num_frames=0, max_frames=64;
+
+        VisitPre(node, depth);
+        stack[num_frames++]={node, depth, 0};
+
+        while(num_frames>0)
+        {
+            WalkFrame* f=&stack[num_frames-1];
+
+            if(f->next_child<MAX_CHILDREN)
+            {
+                TreeNode* child=f->node->child[f->next_child++];
+                if(!child) continue;
+
+                int child_depth=f->depth+1;
+                if(num_frames==max_frames) GrowFrames(&stack, num_frames, &max_frames, local_stack);
+                VisitPre(child, child_depth);
+                stack[num_frames++]={child, child_depth, 0};
+                continue;
+            }
+
+            // children done: leave the node and go on with its sibling at the same depth
+            TreeNode* next=f->node->sibling;
+            VisitPost(f->node, f->depth);
+            if(next)
+            {
+                VisitPre(next, f->depth);
+                f->node=next;
+                f->next_child=0;
+            }
+            else num_frames--;
+        }
+
+        if(stack!=local_stack) delete[] stack;
+    }
+};
+
+// Runs several passes in one walk; at every node the hooks run in the order the
+// passes are given, so a pass that frees nodes must come last
+template<class... Passes>
+struct FusedWalker : TreeWalker<FusedWalker<Passes...>>
+{
+    tuple<Passes&...> passes;
+
+    FusedWalker(Passes&... _passes) : passes(_passes...)
+    {
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        apply([=](Passes&... p) { (p.template Pre<kind>(node, depth), ...); }, passes);
+    }
+    template<NodeKind kind> void Post(TreeNode* node, int depth)
+    {
+        apply([=](Passes&... p) { (p.template Post<kind>(node, depth), ...); }, passes);
+    }
+};
+
+// Prints every node on its own line, indented 3 spaces per level
+struct TreePrinter : TreeWalker<TreePrinter>
+{
+    int sh;
+
+    TreePrinter(int _sh=0)
+    {
+        sh=_sh;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        int NSH=3;
+        printf("%*s", sh+depth*NSH, "");
+
+        printf("[%s]", NodeKindStr[kind]);
+
+        if(kind==OPER_NODE) printf("[%s]", TokenTypeStr[node->oper]);
+        else if(kind==NUM_NODE) printf("[%d]", node->num);
+        else if(kind==ID_NODE || kind==READ_NODE || kind==ASSIGN_NODE) printf("[%s]", node->id);
+
+        if(node->expr_data_type!=VOID) printf("[%s]", ExprDataTypeStr[node->expr_data_type]);
+
+        printf("\n");
+    }
+};
+
+// Counts the nodes of every kind and the depth of the tree
+struct TreeStats : TreeWalker<TreeStats>
 {
-    int i, NSH=3;
-    for(i=0; i<sh; i++) printf(" ");
+    long long num_nodes;
+    long long num_kind_nodes[ID_NODE+1];
+    int max_depth;
+
+    TreeStats()
+    {
+        num_nodes=0;
+        int i;
+        for(i=0; i<=ID_NODE; i++) num_kind_nodes[i]=0;
+        max_depth=0;
+    }
 
-    printf("[%s]", NodeKindStr[node->node_kind]);
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        num_nodes++;
+        num_kind_nodes[kind]++;
+        if(depth>max_depth) max_depth=depth;
+    }
 
-    if(node->node_kind==OPER_NODE) printf("[%s]", TokenTypeStr[node->oper]);
-    else if(node->node_kind==NUM_NODE) printf("[%d]", node->num);
-    else if(node->node_kind==ID_NODE || node->node_kind==READ_NODE || node->node_kind==ASSIGN_NODE ) printf("[%s]", node->id);
+    void Report(OutFile* out_file)
+    {
+        if(!out_file->file) return;
 
-    if(node->expr_data_type!=VOID) printf("[%s]", ExprDataTypeStr[node->expr_data_type]);
+        char buf[64];
+        sprintf(buf, "Nodes: %lld", num_nodes);
+        out_file->Out(buf);
+        int i;
+        for(i=0; i<=ID_NODE; i++)
+        {
+            sprintf(buf, "  %s: %lld", NodeKindStr[i], num_kind_nodes[i]);
+            out_file->Out(buf);
+        }
+        sprintf(buf, "Max depth: %d", max_depth);
+        out_file->Out(buf);
+    }
+};
 
-    printf("\n");
+// Frees every node and its identifier
+struct TreeReleaser : TreeWalker<TreeReleaser>
+{
+    template<NodeKind kind> void Post(TreeNode* node, int depth)
+    {
+        if(kind==ID_NODE || kind==READ_NODE || kind==ASSIGN_NODE) delete[] node->id;
+        delete node;
+    }
+};
 
-    for(i=0; i<MAX_CHILDREN; i++) if(node->child[i]) PrintTree(node->child[i], sh+NSH);
-    if(node->sibling) PrintTree(node->sibling, sh);
+// Function to display the structure of the tree
+void PrintTree(TreeNode* node, int sh=0)
+{
+    TreePrinter printer(sh);
+    printer.Walk(node);
 }
 
 //Function  to release the tree and free the memory
 void Release_Tree(TreeNode* root)
 {
-    //do nothing
-    if (root == NULL)
+    TreeReleaser releaser;
+    releaser.Walk(root);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Semantic Analysis ///////////////////////////////////////////////////////////////
+
+struct Symbol
+{
+    unsigned hash;
+    char* name; // 0 for an empty slot
+    bool assigned; // seen in := or read
+    bool reported; // already reported as read before assigned
+    int index; // order in which the symbol was added
+};
+
+// Variables by name, open addressing with linear probing
+// The table keeps the hash next to the name so most probes never touch the string,
+// and grows to keep at most half the slots used
+struct SymbolTable
+{
+    Symbol* slots;
+    int num_slots, num_symbols;
+
+    SymbolTable()
     {
-        return;
+        num_slots=64;
+        num_symbols=0;
+        slots=new Symbol[num_slots];
+        Clear(slots, num_slots);
+    }
+    ~SymbolTable()
+    {
+        int i;
+        for(i=0; i<num_slots; i++) delete[] slots[i].name;
+        delete[] slots;
+    }
+
+    static void Clear(Symbol* s, int n)
+    {
+        int i;
+        for(i=0; i<n; i++)
+        {
+            s[i].name=0;
+            s[i].assigned=false;
+            s[i].reported=false;
+        }
+    }
+
+    static unsigned Hash(const char* name) // FNV-1a
+    {
+        unsigned h=2166136261u;
+        for(; *name; name++) h=(h^(unsigned char)*name)*16777619u;
+        return h;
+    }
+
+    Symbol* Probe(Symbol* s, int n, unsigned hash, const char* name)
+    {
+        int i=hash&(n-1);
+        while(s[i].name && (s[i].hash!=hash || !Equals(s[i].name, name))) i=(i+1)&(n-1);
+        return &s[i];
+    }
+
+    void Grow()
+    {
+        int n=2*num_slots;
+        Symbol* s=new Symbol[n];
+        Clear(s, n);
+        int i;
+        for(i=0; i<num_slots; i++)
+            if(slots[i].name) *Probe(s, n, slots[i].hash, slots[i].name)=slots[i];
+        delete[] slots;
+        slots=s;
+        num_slots=n;
+    }
+
+    // Returns the symbol of name, adding it if it is new
+    Symbol* Get(const char* name)
+    {
+        unsigned hash=Hash(name);
+        Symbol* sym=Probe(slots, num_slots, hash, name);
+        if(sym->name) return sym;
+
+        if(2*(num_symbols+1)>num_slots)
+        {
+            Grow();
+            sym=Probe(slots, num_slots, hash, name);
+        }
+        sym->hash=hash;
+        AllocateAndCopy(&sym->name, name);
+        sym->index=num_symbols++;
+        return sym;
+    }
+};
+
+// Sets expr_data_type of every expression and reports
+//   if/until conditions that are not boolean,
+//   operands of + - * / ^ < = and assigned values that are not integers,
+//   variables read before any := or read (in program order, once per variable)
+// Types are set bottom up in Post, so the pass must finish before the tree is printed.
+// The symbol table outlives the tree, so the pass can run statement by statement.
+struct SemanticAnalyzer : TreeWalker<SemanticAnalyzer>
+{
+    CompilerInfo* ci;
+    SymbolTable symbols;
+    int num_errors;
+
+    SemanticAnalyzer(CompilerInfo* _ci)
+    {
+        ci=_ci;
+        num_errors=0;
+    }
+
+    void Error(TreeNode* node, const char* msg, const char* arg)
+    {
+        char buf[MAX_TOKEN_LEN+128];
+        sprintf(buf, msg, arg);
+        ReportError(ci, node->pos, buf);
+        num_errors++;
+    }
+
+    void CheckType(TreeNode* node, ExprDataType type, const char* msg, const char* arg)
+    {
+        if(node && node->expr_data_type!=type) Error(node, msg, arg);
+    }
+
+    template<NodeKind kind> void Post(TreeNode* node, int depth)
+    {
+        if(kind==NUM_NODE) node->expr_data_type=INTEGER;
+        else if(kind==ID_NODE)
+        {
+            node->expr_data_type=INTEGER;
+            Symbol* sym=symbols.Get(node->id);
+            if(!sym->assigned && !sym->reported)
+            {
+                sym->reported=true;
+                Error(node, "ERROR: Variable '%s' is read before it is assigned", node->id);
+            }
+        }
+        else if(kind==OPER_NODE)
+        {
+            const char* op=TokenTypeStr[node->oper];
+            CheckType(node->child[0], INTEGER, "ERROR: Left operand of %s is not an integer", op);
+            CheckType(node->child[1], INTEGER, "ERROR: Right operand of %s is not an integer", op);
+            node->expr_data_type=(node->oper==LESS_THAN || node->oper==EQUAL) ? BOOLEAN : INTEGER;
+        }
+        else if(kind==IF_NODE) CheckType(node->child[0], BOOLEAN, "ERROR: %s condition is not boolean", "If");
+        else if(kind==REPEAT_NODE) CheckType(node->child[1], BOOLEAN, "ERROR: %s condition is not boolean", "Until");
+        else if(kind==ASSIGN_NODE)
+        {
+            CheckType(node->child[0], INTEGER, "ERROR: Value assigned to '%s' is not an integer", node->id);
+            if(node->id) symbols.Get(node->id)->assigned=true;
+        }
+        else if(kind==READ_NODE)
+        {
+            if(node->id) symbols.Get(node->id)->assigned=true;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+// Optimizer ///////////////////////////////////////////////////////////////////////
+
+// Optional pass over the whole tree (-O), run before code generation:
+//   forward: copy and constant propagation, folding of + - * / ^ on numbers
+//   backward: dead store elimination by liveness
+// read and write are side effects and are never removed, nor is an assignment whose value
+// may trap (a division by anything but a number other than 0 and -1).
+// The branches of an if start from the same state and are joined after it.
+// A repeat body runs again after its condition, so on the way in the forward pass forgets
+// every fact the loop may change, and the backward pass keeps every variable the loop
+// reads live at the end of the body.
+// Branch states are not copied: every change is logged and undone (UndoState), so the
+// work follows the size of the tree and not the number of variables times branches.
+
+// Values per variable with an undo log
+// Before a branch take Mark(), after the first branch call Switch(mark) and after the
+// second Join(mark, saved_start, meet): every value changed in either branch becomes
+// meet of its values at the end of the two branches.
+template<class T>
+struct UndoState
+{
+    struct Change
+    {
+        int var;
+        T old;
+    };
+
+    T* values;
+    int num_values;
+
+    Change* log;
+    int num_log, max_log;
+
+    Change* saved; // values kept across a branch, a stack in nested branches
+    int num_saved, max_saved;
+    int* saved_pos; // position of a variable in saved, valid if saved[pos].var is the variable
+
+    UndoState(int n, T value)
+    {
+        num_values=n;
+        values=new T[n+1];
+        saved_pos=new int[n+1];
+        int i;
+        for(i=0; i<n; i++)
+        {
+            values[i]=value;
+            saved_pos[i]=0;
+        }
+        num_log=num_saved=0;
+        max_log=max_saved=64;
+        log=new Change[max_log];
+        saved=new Change[max_saved];
+    }
+    ~UndoState()
+    {
+        delete[] values;
+        delete[] saved_pos;
+        delete[] log;
+        delete[] saved;
     }
 
-    //Release the children
-    int i = 0;
-    while (i < MAX_CHILDREN)
+    void Set(int var, T value)
     {
-        if (root->child[i])
+        if(values[var]==value) return;
+        if(num_log==max_log) GrowFrames(&log, num_log, &max_log, (Change*)0);
+        log[num_log++]={var, values[var]};
+        values[var]=value;
+    }
+
+    int Mark()
+    {
+        return num_log;
+    }
+
+    void Undo(int mark)
+    {
+        while(num_log>mark)
         {
-            Release_Tree(root->child[i]);
+            num_log--;
+            values[log[num_log].var]=log[num_log].old;
         }
-        i++;
     }
 
-    //free the node
-    free(root);
+    void Save(int var, T value, int saved_start)
+    {
+        int pos=saved_pos[var];
+        if(pos>=saved_start && pos<num_saved && saved[pos].var==var) return;
+        if(num_saved==max_saved) GrowFrames(&saved, num_saved, &max_saved, (Change*)0);
+        saved_pos[var]=num_saved;
+        saved[num_saved++]={var, value};
+    }
+
+    // Keeps the values at the end of the first branch and goes back to the state at mark
+    int Switch(int mark)
+    {
+        int i, saved_start=num_saved;
+        for(i=mark; i<num_log; i++) Save(log[i].var, values[log[i].var], saved_start);
+        Undo(mark);
+        return saved_start;
+    }
+
+    void Join(int mark, int saved_start, T (*meet)(T a, T b))
+    {
+        // a variable only the second branch changed had its value at mark in the first,
+        // that is the old value of its first change
+        int i, end=num_log;
+        for(i=mark; i<end; i++) Save(log[i].var, log[i].old, saved_start);
+        for(i=saved_start; i<num_saved; i++) Set(saved[i].var, meet(saved[i].old, values[saved[i].var]));
+        num_saved=saved_start;
+    }
+};
+
+enum FactKind {FACT_NONE, FACT_NUM, FACT_COPY};
+
+// What is known about the value of a variable at some point of the program
+struct Fact
+{
+    FactKind kind;
+    int value; // the number, or the index of the copied variable
+    int version; // version of the copied variable when it was copied
+};
+
+inline bool operator==(const Fact& a, const Fact& b)
+{
+    return a.kind==b.kind && (a.kind==FACT_NONE || (a.value==b.value && a.version==b.version));
+}
+
+Fact MeetFacts(Fact a, Fact b)
+{
+    if(a==b) return a;
+    Fact none={FACT_NONE, 0, 0};
+    return none;
+}
+
+bool MeetLive(bool a, bool b)
+{
+    return a || b;
+}
+
+// Value of a op b as the generated code computes it, false if it traps or is a comparison
+bool FoldOper(TokenType oper, int a, int b, int* result)
+{
+    unsigned ua=a, ub=b;
+    if(oper==PLUS) *result=(int)(ua+ub);
+    else if(oper==MINUS) *result=(int)(ua-ub);
+    else if(oper==TIMES) *result=(int)(ua*ub);
+    else if(oper==DIVIDE)
+    {
+        if(b==0 || (a==INT_MIN && b==-1)) return false;
+        *result=a/b;
+    }
+    else if(oper==POWER)
+    {
+        unsigned r=1;
+        for(; b>0; b>>=1)
+        {
+            if(b&1) r*=ua;
+            ua*=ua;
+        }
+        *result=(int)r;
+    }
+    else return false;
+    return true;
 }
 
-int main()
+struct Optimizer
 {
-    CompilerInfo ci("input.txt", "output.txt", "debug.txt");
+    SymbolTable symbols; // Symbol::index is the variable index of the passes
+    char** names; // by variable index
+    int num_vars;
 
-    TreeNode* pt = Parser(&ci);
+    UndoState<Fact>* facts; // forward pass
+    int* versions; // bumped at every store, a copy of an older version is stale
+    UndoState<bool>* live; // backward pass
 
-    //Print the structure of the parse tree's terminal (leaf) nodes
-    cout << "Parse Tree :" << endl;
-    PrintTree(pt,0);
+    TreeNode** seq; // statements of the sequences being eliminated, a stack
+    int num_seq, max_seq;
+
+    long long num_removed;
+
+    Optimizer()
+    {
+        names=0;
+        num_vars=0;
+        facts=0;
+        versions=0;
+        live=0;
+        num_seq=0;
+        max_seq=64;
+        seq=new TreeNode*[max_seq];
+        num_removed=0;
+    }
+    ~Optimizer()
+    {
+        delete[] names;
+        delete facts;
+        delete[] versions;
+        delete live;
+        delete[] seq;
+    }
+
+    int VarIndex(const char* name)
+    {
+        return symbols.Get(name)->index;
+    }
+
+    // Starts the passes once every variable of the tree is in symbols
+    void Init()
+    {
+        num_vars=symbols.num_symbols;
+        names=new char*[num_vars+1];
+        int i;
+        for(i=0; i<symbols.num_slots; i++)
+            if(symbols.slots[i].name) names[symbols.slots[i].index]=symbols.slots[i].name;
+
+        Fact none={FACT_NONE, 0, 0};
+        facts=new UndoState<Fact>(num_vars, none);
+        versions=new int[num_vars+1];
+        for(i=0; i<num_vars; i++) versions[i]=0;
+        live=new UndoState<bool>(num_vars, false);
+    }
+
+    // The variable gets a new value, described by fact
+    void Store(int var, Fact fact)
+    {
+        versions[var]++;
+        facts->Set(var, fact);
+    }
+
+    // Frees a subtree cut out of the tree and counts its nodes
+    void Remove(TreeNode* node)
+    {
+        node->sibling=0;
+        TreeStats stats;
+        TreeReleaser releaser;
+        FusedWalker<TreeStats, TreeReleaser>(stats, releaser).Walk(node);
+        num_removed+=stats.num_nodes;
+    }
+};
+
+// Adds every variable of the tree to the optimizer's symbols
+struct OptVarCollector : TreeWalker<OptVarCollector>
+{
+    Optimizer* opt;
+
+    OptVarCollector(Optimizer* _opt)
+    {
+        opt=_opt;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        if((kind==ID_NODE || kind==READ_NODE || kind==ASSIGN_NODE) && node->id) opt->VarIndex(node->id);
+    }
+};
+
+// Replaces the variables of an expression by what the facts know about them and folds
+// the operations left on two numbers, nodes are changed in place
+struct ExprPropagator : TreeWalker<ExprPropagator>
+{
+    Optimizer* opt;
+
+    ExprPropagator(Optimizer* _opt)
+    {
+        opt=_opt;
+    }
+
+    template<NodeKind kind> void Post(TreeNode* node, int depth)
+    {
+        if(kind==ID_NODE)
+        {
+            Fact f=opt->facts->values[opt->VarIndex(node->id)];
+            if(f.kind==FACT_NUM)
+            {
+                delete[] node->id;
+                node->node_kind=NUM_NODE;
+                node->num=f.value;
+            }
+            else if(f.kind==FACT_COPY && opt->versions[f.value]==f.version)
+            {
+                delete[] node->id;
+                AllocateAndCopy(&node->id, opt->names[f.value]);
+            }
+        }
+        else if(kind==OPER_NODE)
+        {
+            TreeNode* a=node->child[0];
+            TreeNode* b=node->child[1];
+            int result;
+            if(a->node_kind!=NUM_NODE || b->node_kind!=NUM_NODE || !FoldOper(node->oper, a->num, b->num, &result)) return;
+            opt->Remove(a);
+            opt->Remove(b);
+            node->child[0]=node->child[1]=0;
+            node->node_kind=NUM_NODE;
+            node->num=result;
+        }
+    }
+};
+
+// Forgets the facts of every variable a loop stores to
+struct LoopStoreKiller : TreeWalker<LoopStoreKiller>
+{
+    Optimizer* opt;
+
+    LoopStoreKiller(Optimizer* _opt)
+    {
+        opt=_opt;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        Fact none={FACT_NONE, 0, 0};
+        if(kind==READ_NODE || kind==ASSIGN_NODE) opt->Store(opt->VarIndex(node->id), none);
+    }
+};
+
+// Makes every variable read in a subtree live
+struct UseMarker : TreeWalker<UseMarker>
+{
+    Optimizer* opt;
+
+    UseMarker(Optimizer* _opt)
+    {
+        opt=_opt;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        if(kind==ID_NODE) opt->live->Set(opt->VarIndex(node->id), true);
+    }
+};
+
+// Finds a division that may trap
+struct TrapFinder : TreeWalker<TrapFinder>
+{
+    bool may_trap;
+
+    TrapFinder()
+    {
+        may_trap=false;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        if(kind!=OPER_NODE || node->oper!=DIVIDE) return;
+        TreeNode* b=node->child[1];
+        if(b->node_kind!=NUM_NODE || b->num==0 || b->num==-1) may_trap=true;
+    }
+};
+
+bool MayTrap(TreeNode* expr)
+{
+    TrapFinder finder;
+    finder.Walk(expr);
+    return finder.may_trap;
+}
+
+// Forward pass over a statement sequence
+void PropagateSeq(Optimizer* opt, TreeNode* node)
+{
+    ExprPropagator propagator(opt);
+
+    for(; node; node=node->sibling)
+    {
+        if(node->node_kind==ASSIGN_NODE)
+        {
+            propagator.Walk(node->child[0]);
+
+            int var=opt->VarIndex(node->id);
+            TreeNode* value=node->child[0];
+            Fact f={FACT_NONE, 0, 0};
+            if(value->node_kind==NUM_NODE)
+            {
+                f.kind=FACT_NUM;
+                f.value=value->num;
+            }
+            else if(value->node_kind==ID_NODE)
+            {
+                int src=opt->VarIndex(value->id);
+                if(src!=var)
+                {
+                    f.kind=FACT_COPY;
+                    f.value=src;
+                    f.version=opt->versions[src];
+                }
+            }
+            opt->Store(var, f);
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            Fact none={FACT_NONE, 0, 0};
+            opt->Store(opt->VarIndex(node->id), none);
+        }
+        else if(node->node_kind==WRITE_NODE) propagator.Walk(node->child[0]);
+        else if(node->node_kind==IF_NODE)
+        {
+            propagator.Walk(node->child[0]);
+            int mark=opt->facts->Mark();
+            PropagateSeq(opt, node->child[1]);
+            int saved_start=opt->facts->Switch(mark);
+            PropagateSeq(opt, node->child[2]);
+            opt->facts->Join(mark, saved_start, MeetFacts);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            LoopStoreKiller killer(opt);
+            killer.Walk(node->child[0]);
+            PropagateSeq(opt, node->child[0]);
+            propagator.Walk(node->child[1]);
+        }
+    }
+}
+
+// Backward pass over a statement sequence, returns the sequence without its dead statements
+TreeNode* EliminateSeq(Optimizer* opt, TreeNode* head)
+{
+    UseMarker marker(opt);
+
+    int start=opt->num_seq;
+    TreeNode* node;
+    for(node=head; node; node=node->sibling)
+    {
+        if(opt->num_seq==opt->max_seq) GrowFrames(&opt->seq, opt->num_seq, &opt->max_seq, (TreeNode**)0);
+        opt->seq[opt->num_seq++]=node;
+    }
+    int end=opt->num_seq;
+
+    int i;
+    for(i=end-1; i>=start; i--)
+    {
+        node=opt->seq[i];
+
+        if(node->node_kind==ASSIGN_NODE)
+        {
+            int var=opt->VarIndex(node->id);
+            if(!opt->live->values[var] && !MayTrap(node->child[0]))
+            {
+                opt->seq[i]=0;
+                opt->Remove(node);
+                continue;
+            }
+            opt->live->Set(var, false);
+            marker.Walk(node->child[0]);
+        }
+        else if(node->node_kind==READ_NODE) opt->live->Set(opt->VarIndex(node->id), false);
+        else if(node->node_kind==WRITE_NODE) marker.Walk(node->child[0]);
+        else if(node->node_kind==IF_NODE)
+        {
+            int mark=opt->live->Mark();
+            node->child[1]=EliminateSeq(opt, node->child[1]);
+            int saved_start=opt->live->Switch(mark);
+            node->child[2]=EliminateSeq(opt, node->child[2]);
+            opt->live->Join(mark, saved_start, MeetLive);
+
+            if(!node->child[1] && !node->child[2] && !MayTrap(node->child[0]))
+            {
+                opt->seq[i]=0;
+                opt->Remove(node);
+                continue;
+            }
+            marker.Walk(node->child[0]);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            // live at the end of the body: after the loop, the condition, and the next round
+            marker.Walk(node->child[1]);
+            marker.Walk(node->child[0]);
+            node->child[0]=EliminateSeq(opt, node->child[0]);
+        }
+    }
+
+    TreeNode* first=0;
+    TreeNode* last=0;
+    for(i=start; i<end; i++)
+    {
+        node=opt->seq[i];
+        if(!node) continue;
+        if(last) last->sibling=node;
+        else first=node;
+        last=node;
+    }
+    if(last) last->sibling=0;
+
+    opt->num_seq=start;
+    return first;
+}
+
+// Runs the optimizer on a tree without syntax errors, returns the new root
+// (0 if no statement is left) and the number of nodes it freed
+TreeNode* Optimize(TreeNode* root, long long* num_removed)
+{
+    Optimizer opt;
+    OptVarCollector collector(&opt);
+    collector.Walk(root);
+    opt.Init();
+
+    PropagateSeq(&opt, root);
+    root=EliminateSeq(&opt, root);
+
+    *num_removed=opt.num_removed;
+    return root;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Code Generator //////////////////////////////////////////////////////////////////
+
+// Emits x86-64 assembly (GNU as, AT&T syntax) for the whole program as main()
+// read/write go through scanf/printf of the C runtime: gcc prog.s -o prog
+// all values are 32 bit ints, uninitialized variables start at 0, read gives 0 at end of input
+// expressions are evaluated into %eax, the right operand goes through %ecx
+// the most referenced variables live in the callee saved registers, the rest in .bss
+
+#define NUM_VAR_REGS 5
+
+const char* VarRegStr[NUM_VAR_REGS]=
+{
+    "%ebx", "%r12d", "%r13d", "%r14d", "%r15d"
+};
+
+const char* VarRegSaveStr[NUM_VAR_REGS]=
+{
+    "%rbx", "%r12", "%r13", "%r14", "%r15"
+};
+
+struct CodeVar
+{
+    char* name;
+    int num_refs;
+    int reg; // index in VarRegStr or -1 if kept in memory
+};
+
+struct CodeGenInfo
+{
+    OutFile* out_file;
+
+    SymbolTable symbols; // Symbol::index is the index in vars
+    CodeVar* vars;
+    int num_vars, max_vars;
+    int num_regs_used;
+
+    int num_labels;
+
+    CodeGenInfo(OutFile* _out_file)
+    {
+        out_file=_out_file;
+        vars=0;
+        num_vars=0;
+        max_vars=0;
+        num_regs_used=0;
+        num_labels=0;
+    }
+    ~CodeGenInfo()
+    {
+        delete[] vars;
+    }
+
+    CodeVar* FindVar(const char* name)
+    {
+        return &vars[symbols.Get(name)->index];
+    }
+
+    void AddVarRef(const char* name)
+    {
+        Symbol* sym=symbols.Get(name);
+        if(sym->index<num_vars)
+        {
+            vars[sym->index].num_refs++;
+            return;
+        }
+
+        if(num_vars==max_vars)
+        {
+            max_vars=max_vars ? 2*max_vars : 16;
+            CodeVar* new_vars=new CodeVar[max_vars];
+            int i;
+            for(i=0; i<num_vars; i++) new_vars[i]=vars[i];
+            delete[] vars;
+            vars=new_vars;
+        }
+        vars[num_vars].name=sym->name;
+        vars[num_vars].num_refs=1;
+        vars[num_vars].reg=-1;
+        num_vars++;
+    }
+
+    int NewLabel()
+    {
+        return num_labels++;
+    }
+};
+
+void Emit(CodeGenInfo* cg, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(cg->out_file->file, format, args);
+    va_end(args);
+    fputc('\n', cg->out_file->file);
+}
+
+// Counts the references of every variable in the tree
+struct VarCollector : TreeWalker<VarCollector>
+{
+    CodeGenInfo* cg;
+
+    VarCollector(CodeGenInfo* _cg)
+    {
+        cg=_cg;
+    }
+
+    template<NodeKind kind> void Pre(TreeNode* node, int depth)
+    {
+        if((kind==ID_NODE || kind==READ_NODE || kind==ASSIGN_NODE) && node->id) cg->AddVarRef(node->id);
+    }
+};
+
+// Gives the callee saved registers to the most referenced variables
+void AssignVarRegs(CodeGenInfo* cg)
+{
+    while(cg->num_regs_used<NUM_VAR_REGS)
+    {
+        CodeVar* best=0;
+        int i;
+        for(i=0; i<cg->num_vars; i++)
+        {
+            CodeVar* v=&cg->vars[i];
+            if(v->reg<0 && (!best || v->num_refs>best->num_refs)) best=v;
+        }
+        if(!best) break;
+        best->reg=cg->num_regs_used++;
+    }
+}
+
+// Writes the assembly operand of a variable or a number into buf
+void GetOperand(CodeGenInfo* cg, TreeNode* node, char* buf)
+{
+    if(node->node_kind==NUM_NODE)
+    {
+        sprintf(buf, "$%d", node->num);
+        return;
+    }
+    CodeVar* v=cg->FindVar(node->id);
+    if(v->reg>=0) strcpy(buf, VarRegStr[v->reg]);
+    else sprintf(buf, ".Lv_%s(%%rip)", node->id);
+}
+
+inline bool IsLeafExpr(TreeNode* node)
+{
+    return node->node_kind==NUM_NODE || node->node_kind==ID_NODE;
+}
+
+void GenExpr(CodeGenInfo* cg, TreeNode* node);
+
+// Evaluates the left operand into %eax and returns the right one as an operand string,
+// the right operand is put in %ecx unless it is a number or a variable
+void GenOperands(CodeGenInfo* cg, TreeNode* node, char* right)
+{
+    if(IsLeafExpr(node->child[1]))
+    {
+        GenExpr(cg, node->child[0]);
+        GetOperand(cg, node->child[1], right);
+        return;
+    }
+
+    GenExpr(cg, node->child[1]);
+    if(IsLeafExpr(node->child[0]))
+    {
+        Emit(cg, "\tmovl\t%%eax, %%ecx");
+        GenExpr(cg, node->child[0]);
+    }
+    else
+    {
+        Emit(cg, "\tpushq\t%%rax");
+        GenExpr(cg, node->child[0]);
+        Emit(cg, "\tpopq\t%%rcx");
+    }
+    strcpy(right, "%ecx");
+}
+
+// Applies the operator of node to %eax and the right operand op
+void GenOper(CodeGenInfo* cg, TreeNode* node, const char* op)
+{
+    if(node->oper==PLUS) Emit(cg, "\taddl\t%s, %%eax", op);
+    else if(node->oper==MINUS) Emit(cg, "\tsubl\t%s, %%eax", op);
+    else if(node->oper==TIMES) Emit(cg, "\timull\t%s, %%eax", op);
+    else if(node->oper==DIVIDE)
+    {
+        if(!Equals(op, "%ecx")) Emit(cg, "\tmovl\t%s, %%ecx", op);
+        Emit(cg, "\tcltd");
+        Emit(cg, "\tidivl\t%%ecx");
+    }
+    else if(node->oper==POWER)
+    {
+        // square and multiply, negative exponents give 1
+        int loop=cg->NewLabel(), skip=cg->NewLabel(), done=cg->NewLabel();
+        if(!Equals(op, "%ecx")) Emit(cg, "\tmovl\t%s, %%ecx", op);
+        Emit(cg, "\tmovl\t%%eax, %%esi");
+        Emit(cg, "\tmovl\t$1, %%eax");
+        Emit(cg, ".L%d:", loop);
+        Emit(cg, "\ttestl\t%%ecx, %%ecx");
+        Emit(cg, "\tjle\t.L%d", done);
+        Emit(cg, "\ttestl\t$1, %%ecx");
+        Emit(cg, "\tje\t.L%d", skip);
+        Emit(cg, "\timull\t%%esi, %%eax");
+        Emit(cg, ".L%d:", skip);
+        Emit(cg, "\timull\t%%esi, %%esi");
+        Emit(cg, "\tshrl\t%%ecx");
+        Emit(cg, "\tjmp\t.L%d", loop);
+        Emit(cg, ".L%d:", done);
+    }
+    else
+    {
+        Emit(cg, "\tcmpl\t%s, %%eax", op);
+        Emit(cg, node->oper==LESS_THAN ? "\tsetl\t%%al" : "\tsete\t%%al");
+        Emit(cg, "\tmovzbl\t%%al, %%eax");
+    }
+}
+
+struct GenFrame
+{
+    TreeNode* node;
+    int stage; // operands already evaluated
+};
+
+// Evaluates an expression into %eax in the same order as GenOperands,
+// with an explicit stack so long operator chains do not recurse
+void GenExpr(CodeGenInfo* cg, TreeNode* root)
+{
+    char op[MAX_TOKEN_LEN+32];
+
+    GenFrame local_stack[64];
+    GenFrame* stack=local_stack;
+    int num_frames=0, max_frames=64;
+    stack[num_frames++]={root, 0};
+
+    while(num_frames>0)
+    {
+        GenFrame* f=&stack[num_frames-1];
+        TreeNode* node=f->node;
+
+        if(IsLeafExpr(node))
+        {
+            GetOperand(cg, node, op);
+            Emit(cg, "\tmovl\t%s, %%eax", op);
+            num_frames--;
+            continue;
+        }
+
+        TreeNode* left=node->child[0];
+        TreeNode* right=node->child[1];
+        TreeNode* sub=0;
+
+        if(IsLeafExpr(right))
+        {
+            // left into %eax, then the operator with the number or variable
+            if(f->stage==0) sub=left;
+            else
+            {
+                GetOperand(cg, right, op);
+                GenOper(cg, node, op);
+            }
+        }
+        else if(IsLeafExpr(left))
+        {
+            // right into %ecx, then left into %eax
+            if(f->stage==0) sub=right;
+            else
+            {
+                Emit(cg, "\tmovl\t%%eax, %%ecx");
+                GetOperand(cg, left, op);
+                Emit(cg, "\tmovl\t%s, %%eax", op);
+                GenOper(cg, node, "%ecx");
+            }
+        }
+        else
+        {
+            // right kept on the stack while left is evaluated
+            if(f->stage==0) sub=right;
+            else if(f->stage==1)
+            {
+                Emit(cg, "\tpushq\t%%rax");
+                sub=left;
+            }
+            else
+            {
+                Emit(cg, "\tpopq\t%%rcx");
+                GenOper(cg, node, "%ecx");
+            }
+        }
+
+        if(sub)
+        {
+            f->stage++;
+            if(num_frames==max_frames) GrowFrames(&stack, num_frames, &max_frames, local_stack);
+            stack[num_frames++]={sub, 0};
+        }
+        else num_frames--;
+    }
+
+    if(stack!=local_stack) delete[] stack;
+}
+
+// Jumps to false_label when the condition does not hold
+void GenCondJump(CodeGenInfo* cg, TreeNode* node, int false_label)
+{
+    if(node->node_kind==OPER_NODE && (node->oper==LESS_THAN || node->oper==EQUAL))
+    {
+        char op[MAX_TOKEN_LEN+32];
+        GenOperands(cg, node, op);
+        Emit(cg, "\tcmpl\t%s, %%eax", op);
+        Emit(cg, node->oper==LESS_THAN ? "\tjge\t.L%d" : "\tjne\t.L%d", false_label);
+        return;
+    }
+    GenExpr(cg, node);
+    Emit(cg, "\ttestl\t%%eax, %%eax");
+    Emit(cg, "\tje\t.L%d", false_label);
+}
+
+void GenStore(CodeGenInfo* cg, const char* name)
+{
+    CodeVar* v=cg->FindVar(name);
+    if(v->reg>=0) Emit(cg, "\tmovl\t%%eax, %s", VarRegStr[v->reg]);
+    else Emit(cg, "\tmovl\t%%eax, .Lv_%s(%%rip)", name);
+}
+
+void GenStmtSeq(CodeGenInfo* cg, TreeNode* node)
+{
+    for(; node; node=node->sibling)
+    {
+        if(node->node_kind==ASSIGN_NODE)
+        {
+            GenExpr(cg, node->child[0]);
+            GenStore(cg, node->id);
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            Emit(cg, "\tmovl\t$0, .Lread_tmp(%%rip)");
+            Emit(cg, "\tleaq\t.Lread_tmp(%%rip), %%rsi");
+            Emit(cg, "\tleaq\t.Lfmt_in(%%rip), %%rdi");
+            Emit(cg, "\txorl\t%%eax, %%eax");
+            Emit(cg, "\tcall\tscanf@PLT");
+            Emit(cg, "\tmovl\t.Lread_tmp(%%rip), %%eax");
+            GenStore(cg, node->id);
+        }
+        else if(node->node_kind==WRITE_NODE)
+        {
+            GenExpr(cg, node->child[0]);
+            Emit(cg, "\tmovl\t%%eax, %%esi");
+            Emit(cg, "\tleaq\t.Lfmt_out(%%rip), %%rdi");
+            Emit(cg, "\txorl\t%%eax, %%eax");
+            Emit(cg, "\tcall\tprintf@PLT");
+        }
+        else if(node->node_kind==IF_NODE)
+        {
+            int else_label=cg->NewLabel();
+            GenCondJump(cg, node->child[0], else_label);
+            GenStmtSeq(cg, node->child[1]);
+            if(node->child[2])
+            {
+                int end_label=cg->NewLabel();
+                Emit(cg, "\tjmp\t.L%d", end_label);
+                Emit(cg, ".L%d:", else_label);
+                GenStmtSeq(cg, node->child[2]);
+                Emit(cg, ".L%d:", end_label);
+            }
+            else Emit(cg, ".L%d:", else_label);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            int top_label=cg->NewLabel();
+            Emit(cg, ".L%d:", top_label);
+            GenStmtSeq(cg, node->child[0]);
+            GenCondJump(cg, node->child[1], top_label);
+        }
+    }
+}
+
+// Writes the program as an assembly file with a main() entry point
+void GenerateCode(TreeNode* root, OutFile* out_file)
+{
+    if(!out_file->file) return;
+
+    CodeGenInfo cg(out_file);
+    VarCollector collector(&cg);
+    collector.Walk(root);
+    AssignVarRegs(&cg);
+
+    int i;
+    Emit(&cg, "\t.text");
+    Emit(&cg, "\t.globl\tmain");
+    Emit(&cg, "\t.type\tmain, @function");
+    Emit(&cg, "main:");
+
+    // 5 pushes keep %rsp 16 byte aligned for the calls
+    for(i=0; i<NUM_VAR_REGS; i++) Emit(&cg, "\tpushq\t%s", VarRegSaveStr[i]);
+    for(i=0; i<cg.num_regs_used; i++) Emit(&cg, "\txorl\t%s, %s", VarRegStr[i], VarRegStr[i]);
+
+    GenStmtSeq(&cg, root);
+
+    Emit(&cg, "\txorl\t%%eax, %%eax");
+    for(i=NUM_VAR_REGS-1; i>=0; i--) Emit(&cg, "\tpopq\t%s", VarRegSaveStr[i]);
+    Emit(&cg, "\tret");
+    Emit(&cg, "\t.size\tmain, .-main");
+
+    Emit(&cg, "\t.section\t.rodata");
+    Emit(&cg, ".Lfmt_in:\n\t.string\t\"%%d\"");
+    Emit(&cg, ".Lfmt_out:\n\t.string\t\"%%d\\n\"");
+
+    Emit(&cg, "\t.bss");
+    Emit(&cg, "\t.align\t4");
+    Emit(&cg, ".Lread_tmp:\n\t.zero\t4");
+    for(i=0; i<cg.num_vars; i++)
+        if(cg.vars[i].reg<0) Emit(&cg, ".Lv_%s:\n\t.zero\t4", cg.vars[i].name);
+
+    Emit(&cg, "\t.section\t.note.GNU-stack,\"\",@progbits");
+    fflush(out_file->file);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Library API /////////////////////////////////////////////////////////////////////
+
+// The C interface of tiny.h, everything a parse needs is owned by its context
+static_assert(TINY_ERROR==(int)ERROR && TINY_ID_NODE==(int)ID_NODE, "tiny.h enums out of date");
+
+struct TinyContext
+{
+    CompilerInfo* ci; // of the last parse, reads from buf
+    char* buf; // copy of the source
+    TreeNode* root;
+    TokenList tokens;
+    DiagnosticList diagnostics;
+
+    TinyContext()
+    {
+        ci=0;
+        buf=0;
+        root=0;
+    }
+    ~TinyContext()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        Release_Tree(root);
+        root=0;
+        delete ci;
+        ci=0;
+        delete[] buf;
+        buf=0;
+        tokens.num_items=0;
+        diagnostics.Clear();
+    }
+
+    // Parses the source in buf, which the context owns from now on
+    int Parse(char* _buf, long long size, const char* name)
+    {
+        buf=_buf;
+        ci=new CompilerInfo(name, buf, size, 0, 0);
+        ci->diagnostics=&diagnostics;
+        ci->tokens=&tokens;
+
+        root=Parser(ci);
+
+        //A parse stopped early leaves tokens behind, scan them too
+        Token token;
+        do GetNextToken(ci, &token);
+        while(token.type!=ENDFILE);
+
+        return diagnostics.num_items;
+    }
+};
+
+inline const TreeNode* ToTreeNode(const TinyNode* node)
+{
+    return reinterpret_cast<const TreeNode*>(node);
+}
+
+inline const TinyNode* ToTinyNode(const TreeNode* node)
+{
+    return reinterpret_cast<const TinyNode*>(node);
+}
+
+TinyContext* TinyCreateContext(void)
+{
+    return new TinyContext;
+}
+
+void TinyFreeContext(TinyContext* ctx)
+{
+    delete ctx;
+}
+
+int TinyParseBuffer(TinyContext* ctx, const char* buf, long long size, const char* name)
+{
+    ctx->Reset();
+    char* copy=new char[size+1];
+    if(size>0) memcpy(copy, buf, size);
+    copy[size]=0;
+    return ctx->Parse(copy, size, name);
+}
+
+int TinyParseFile(TinyContext* ctx, const char* path)
+{
+    ctx->Reset();
+    char* buf;
+    long long size;
+    if(!LoadFileSync(path, &buf, &size)) return -1;
+    return ctx->Parse(buf, size, path);
+}
+
+int TinyGetNumTokens(const TinyContext* ctx)
+{
+    return ctx->tokens.num_items;
+}
+
+int TinyGetToken(const TinyContext* ctx, int ind, TinyToken* token)
+{
+    if(ind<0 || ind>=ctx->tokens.num_items) return 0;
+    const Token* t=&ctx->tokens.items[ind];
+    token->type=t->type;
+    token->type_name=TokenTypeStr[t->type];
+    token->text=t->str;
+    token->pos=t->pos;
+    return 1;
+}
+
+int TinyGetNumDiagnostics(const TinyContext* ctx)
+{
+    return ctx->diagnostics.num_items;
+}
+
+int TinyGetDiagnostic(const TinyContext* ctx, int ind, TinyDiagnostic* diagnostic)
+{
+    if(ind<0 || ind>=ctx->diagnostics.num_items) return 0;
+    const Diagnostic* d=&ctx->diagnostics.items[ind];
+    diagnostic->msg=d->msg;
+    diagnostic->pos=d->pos;
+    diagnostic->line=d->line;
+    diagnostic->col=d->col;
+    return 1;
+}
+
+void TinyGetLocation(TinyContext* ctx, long long pos, long long* line, long long* col)
+{
+    *line=*col=1;
+    if(ctx->ci) ctx->ci->line_index.Find(&ctx->ci->in_file, pos, line, col);
+}
+
+const TinyNode* TinyGetRoot(const TinyContext* ctx)
+{
+    return ToTinyNode(ctx->root);
+}
+
+int TinyGetNodeKind(const TinyNode* node)
+{
+    return ToTreeNode(node)->node_kind;
+}
+
+const char* TinyGetNodeKindName(const TinyNode* node)
+{
+    return NodeKindStr[ToTreeNode(node)->node_kind];
+}
+
+const TinyNode* TinyGetNodeChild(const TinyNode* node, int ind)
+{
+    if(ind<0 || ind>=MAX_CHILDREN) return 0;
+    return ToTinyNode(ToTreeNode(node)->child[ind]);
+}
+
+const TinyNode* TinyGetNodeSibling(const TinyNode* node)
+{
+    return ToTinyNode(ToTreeNode(node)->sibling);
+}
+
+int TinyGetNodeOper(const TinyNode* node)
+{
+    return ToTreeNode(node)->oper;
+}
+
+int TinyGetNodeNum(const TinyNode* node)
+{
+    return ToTreeNode(node)->num;
+}
+
+const char* TinyGetNodeId(const TinyNode* node)
+{
+    const TreeNode* n=ToTreeNode(node);
+    if(n->node_kind!=ID_NODE && n->node_kind!=READ_NODE && n->node_kind!=ASSIGN_NODE) return 0;
+    return n->id;
+}
+
+long long TinyGetNodePos(const TinyNode* node)
+{
+    return ToTreeNode(node)->pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Command Line ////////////////////////////////////////////////////////////////////
+
+// State of the -stream handler, kept across statements
+struct StreamInfo
+{
+    TreeStats stats;
+    SemanticAnalyzer* analyzer; // 0 without -types
+};
+
+//Statement handler for StreamParser: type the statement if asked, print it as
+//PrintTree would, add it to the statistics, then free it
+void PrintAndRelease(TreeNode* stmt, void* data)
+{
+    StreamInfo* si=(StreamInfo*)data;
+    if(si->analyzer) si->analyzer->Walk(stmt);
+
+    TreePrinter printer;
+    TreeReleaser releaser;
+    FusedWalker<TreePrinter, TreeStats, TreeReleaser>(printer, si->stats, releaser).Walk(stmt);
+}
+
+// Command line options
+struct Options
+{
+    const char* asm_str; // 0 without -S
+    bool stream;
+    bool types;
+    bool optimize;
+};
+
+// Parses one source, runs the passes asked for and prints the tree
+void Compile(CompilerInfo* ci, const Options* opt)
+{
+    SemanticAnalyzer analyzer(ci);
+
+    if(opt->stream && !opt->asm_str && !opt->optimize)
+    {
+        StreamInfo si;
+        si.analyzer=opt->types ? &analyzer : 0;
+        cout << "Parse Tree :" << endl;
+        StreamParser(ci, PrintAndRelease, &si);
+        si.stats.Report(&ci->debug_file);
+        return;
+    }
+
+    TreeNode* pt = Parser(ci);
+    int num_parse_errors=ci->num_errors;
+
+    //Fill in the expression types and check them
+    if(opt->types) analyzer.Walk(pt);
+
+    //Propagate copies and constants and drop dead stores
+    if(opt->optimize && num_parse_errors==0)
+    {
+        long long num_removed;
+        pt=Optimize(pt, &num_removed);
+        cout << "Optimizer removed " << num_removed << " nodes" << endl;
+    }
+
+    //Generate the assembly of the program, a tree with syntax errors has holes in it
+    if(opt->asm_str && num_parse_errors>0) cout << "ERROR: No code generated, the program has syntax errors" << endl;
+    else if(opt->asm_str)
+    {
+        OutFile asm_file(opt->asm_str);
+        GenerateCode(pt, &asm_file);
+    }
+
+    //Print the structure of the parse tree's terminal (leaf) nodes,
+    //count its nodes for debug.txt and release it, all in a single walk
+    TreePrinter printer;
+    TreeStats stats;
+    TreeReleaser releaser;
+    cout << "Parse Tree :" << endl;
+    FusedWalker<TreePrinter, TreeStats, TreeReleaser>(printer, stats, releaser).Walk(pt);
+    stats.Report(&ci->debug_file);
+}
+
+// LoadHandler of the batch mode: compiles every file straight from the loader's buffer
+void CompileLoaded(const char* path, char* buf, long long size, void* data)
+{
+    if(!buf)
+    {
+        cout << "ERROR: Cannot read " << path << endl;
+        return;
+    }
+    cout << "File: " << path << endl;
+    CompilerInfo ci(path, buf, size, 0, 0);
+    Compile(&ci, (const Options*)data);
+}
+
+// usage: Ass3_Compilers [-S out.s] [-O] [-stream] [-types] [input files]
+// -S also writes the program as x86-64 assembly, build it with gcc out.s -o prog
+// -O propagates copies and constants and removes dead stores before the tree is printed
+//    and the code generated, the number of nodes removed is printed
+// -stream prints and frees every top level statement as soon as it is parsed,
+//         the output is the same but memory stays bounded by the largest statement
+//         (ignored with -S and -O which need the whole tree)
+// -types runs the semantic pass: the tree is printed with the expression types,
+//        type errors and variables read before being assigned are reported
+// With several input files they are read by the batch loader and every tree is printed
+// after a "File: <path>" line; -S and output.txt/debug.txt are not used then.
+// The Library target builds with TINY_LIBRARY and has no main, see tiny.h
+#ifndef TINY_LIBRARY
+int main(int argc, char* argv[])
+{
+    Options opt;
+    opt.asm_str=0;
+    opt.stream=false;
+    opt.types=false;
+    opt.optimize=false;
+
+    const char** in_strs=new const char*[argc];
+    int num_in_strs=0;
+
+    int i;
+    for(i=1; i<argc; i++)
+    {
+        if(Equals(argv[i], "-S") && i+1<argc) opt.asm_str=argv[++i];
+        else if(Equals(argv[i], "-stream")) opt.stream=true;
+        else if(Equals(argv[i], "-types")) opt.types=true;
+        else if(Equals(argv[i], "-O")) opt.optimize=true;
+        else in_strs[num_in_strs++]=argv[i];
+    }
+
+    //Trees are printed as they complete, so give stdout a large buffer
+    static char out_buf[1<<16];
+    if(opt.stream || num_in_strs>1) setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    if(num_in_strs>1)
+    {
+        opt.asm_str=0;
+        LoadFiles(in_strs, num_in_strs, CompileLoaded, &opt);
+    }
+    else
+    {
+        CompilerInfo ci(num_in_strs ? in_strs[0] : "input.txt", "output.txt", "debug.txt");
+        Compile(&ci, &opt);
+    }
 
-    //Release the parse tree
-    Release_Tree(pt);
+    delete[] in_strs;
     return 0;
 }
+#endif
@@ -0,0 +1,97 @@
+#ifndef TINY_H
+#define TINY_H
+
+// Scanner and parser of the TINY language as a library (the Library target of
+// Ass3_Compilers.cbp, main.cpp built with -DTINY_LIBRARY)
+//
+// All the state of a parse lives in its TinyContext: there are no globals and no fixed
+// file names, so any number of threads may parse at once as long as each context is
+// used by one thread at a time.
+//
+//     TinyContext* ctx=TinyCreateContext();
+//     if(TinyParseFile(ctx, "prog.tny")>=0)
+//         for(const TinyNode* n=TinyGetRoot(ctx); n; n=TinyGetNodeSibling(n)) ...
+//     TinyFreeContext(ctx);
+//
+// Tokens, nodes, diagnostics and every string returned stay valid until the next parse
+// with the same context or until it is freed.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same order as TokenType in main.cpp
+enum TinyTokenType
+{
+    TINY_IF, TINY_THEN, TINY_ELSE, TINY_END, TINY_REPEAT, TINY_UNTIL, TINY_READ, TINY_WRITE,
+    TINY_ASSIGN, TINY_EQUAL, TINY_LESS_THAN,
+    TINY_PLUS, TINY_MINUS, TINY_TIMES, TINY_DIVIDE, TINY_POWER,
+    TINY_SEMI_COLON,
+    TINY_LEFT_PAREN, TINY_RIGHT_PAREN,
+    TINY_LEFT_BRACE, TINY_RIGHT_BRACE,
+    TINY_ID, TINY_NUM,
+    TINY_ENDFILE, TINY_ERROR
+};
+
+// Same order as NodeKind in main.cpp
+enum TinyNodeKind
+{
+    TINY_IF_NODE, TINY_REPEAT_NODE, TINY_ASSIGN_NODE, TINY_READ_NODE, TINY_WRITE_NODE,
+    TINY_OPER_NODE, TINY_NUM_NODE, TINY_ID_NODE
+};
+
+typedef struct TinyContext TinyContext;
+typedef struct TinyNode TinyNode;
+
+typedef struct TinyToken
+{
+    int type; // TinyTokenType
+    const char* type_name; // "If", "ID", ... as printed in the tree
+    const char* text;
+    long long pos; // byte offset in the source
+} TinyToken;
+
+typedef struct TinyDiagnostic
+{
+    const char* msg;
+    long long pos; // byte offset in the source
+    long long line, col; // 1 based
+} TinyDiagnostic;
+
+TinyContext* TinyCreateContext(void);
+void TinyFreeContext(TinyContext* ctx);
+
+// Both return the number of diagnostics, TinyParseFile returns -1 if the file cannot be read
+// The buffer is only read during the call, name is used for nothing but the caller's reference
+int TinyParseBuffer(TinyContext* ctx, const char* buf, long long size, const char* name);
+int TinyParseFile(TinyContext* ctx, const char* path);
+
+// Every token of the source in order, without the end of file
+int TinyGetNumTokens(const TinyContext* ctx);
+int TinyGetToken(const TinyContext* ctx, int ind, TinyToken* token); // 0 if ind is out of range
+
+int TinyGetNumDiagnostics(const TinyContext* ctx);
+int TinyGetDiagnostic(const TinyContext* ctx, int ind, TinyDiagnostic* diagnostic); // 0 if ind is out of range
+
+// 1 based line and column of a byte offset of the last parsed source
+void TinyGetLocation(TinyContext* ctx, long long pos, long long* line, long long* col);
+
+// The tree is the one the command line program prints: a statement sequence is a chain of
+// siblings, if has the condition, then and else part as children 0 1 2, repeat the body
+// and the condition, assign and write their expression, an operator its two operands.
+// The root is 0 for an empty program.
+const TinyNode* TinyGetRoot(const TinyContext* ctx);
+int TinyGetNodeKind(const TinyNode* node); // TinyNodeKind
+const char* TinyGetNodeKindName(const TinyNode* node);
+const TinyNode* TinyGetNodeChild(const TinyNode* node, int ind); // ind 0 to 2, 0 if absent
+const TinyNode* TinyGetNodeSibling(const TinyNode* node);
+int TinyGetNodeOper(const TinyNode* node); // TinyTokenType of an operator node
+int TinyGetNodeNum(const TinyNode* node); // value of a number node
+const char* TinyGetNodeId(const TinyNode* node); // variable of an ID, read or assign node, else 0
+long long TinyGetNodePos(const TinyNode* node); // byte offset of the node's token
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TINY_H